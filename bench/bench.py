@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+# -------------------------------------------------------------
+#
+# Benchmark driver for project_freecell.
+#
+#   bench.py run <binary> <output-prefix> [options]
+#       Runs every method over the corpus (the test files plus generated
+#       deals), one process per run, and writes <output-prefix>.csv and
+#       <output-prefix>.json.
+#
+#   bench.py compare <base.json> <new.json> [--threshold R]
+#       Compares two runs and flags regressions. Exits with 1 if any.
+#
+#   bench.py threads <binary> [options]
+#       Solves generated deals with several --threads counts and checks each
+#       run against the serial one. Exits with 1 if a run hangs, crashes or
+#       misses a solution the serial search found.
+#
+# --------------------------------------------------------------
+
+import argparse
+import csv
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+METHODS = ["breadth", "depth", "best", "astar", "idastar", "beam"]
+TEST_FILES = ["test_file_size_2.txt", "test_file_size_5.txt", "test_file_size_8.txt"]
+FIELDS = ["method", "puzzle", "status", "length", "wall_time", "search_time",
+          "nodes_expanded", "nodes_generated", "nodes_per_sec", "peak_rss_kb"]
+
+
+def generate_deal(n, seed):
+    """Deals the 4*n cards of a puzzle over the 8 stacks, shuffled by a fixed
+    LCG so the corpus does not depend on the Python version."""
+    cards = [suit + str(value) for suit in "HSDC" for value in range(n)]
+    state = seed
+    for i in range(len(cards) - 1, 0, -1):
+        state = (state * 6364136223846793005 + 1442695040888963407) % (1 << 64)
+        j = (state >> 33) % (i + 1)
+        cards[i], cards[j] = cards[j], cards[i]
+    stacks = [cards[i::8] for i in range(8)]
+    return "%d\n" % n + "".join(" ".join(s) + "\n" for s in stacks if s)
+
+
+def build_corpus(root, deals, directory):
+    corpus = [(name, os.path.join(root, name)) for name in TEST_FILES]
+    for k in range(deals):
+        n = 5 + k % 4
+        name = "deal_%d_n%d.txt" % (k, n)
+        path = os.path.join(directory, name)
+        with open(path, "w") as f:
+            f.write(generate_deal(n, 1000 + k))
+        corpus.append((name, path))
+    return corpus
+
+
+def run_one(binary, method, path, options, kill_after=None):
+    """Runs the solver once, returning its result and peak RSS. A run still
+    going after kill_after seconds is killed and reported as a hang."""
+    output = tempfile.NamedTemporaryFile(suffix=".txt", delete=False)
+    output.close()
+    start = time.monotonic()
+    process = subprocess.Popen([binary] + options + [method, path, output.name],
+                               stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    timer = threading.Timer(kill_after, process.kill) if kill_after else None
+    if timer:
+        timer.start()
+    stdout = process.stdout.read().decode(errors="replace")
+    _, status, rusage = os.wait4(process.pid, 0)
+    wall_time = time.monotonic() - start
+    hung = timer is not None and not timer.is_alive()
+    if timer:
+        timer.cancel()
+    process.returncode = os.waitstatus_to_exitcode(status)
+    os.unlink(output.name)
+
+    def number(pattern, cast):
+        m = re.search(pattern, stdout)
+        return cast(m.group(1)) if m else None
+
+    length = number(r"Solution found! \((\d+) steps\)", int)
+    if length is not None:
+        result = "solved"
+    elif hung:
+        result = "hang"
+    elif "time limit reached" in stdout:
+        result = "timeout"
+    elif "node limit reached" in stdout:
+        result = "node-limit"
+    elif "RSS limit reached" in stdout:
+        result = "rss-limit"
+    elif "layer files" in stdout:
+        result = "disk-error"
+    elif "Memory exhausted" in stdout or "out of memory" in stdout:
+        result = "memory"
+    elif process.returncode != 0:
+        result = "crash"
+    else:
+        result = "unsolved"
+    search_time = number(r"Time spent: ([0-9.]+) secs", float)
+    expanded = number(r"Nodes expanded: (\d+)", int)
+    generated = number(r"Nodes generated: (\d+)", int)
+    rate = expanded / search_time if expanded and search_time else None
+    # ru_maxrss also counts the forked interpreter, the solver's own figure is exact.
+    rss = number(r"Peak memory: (\d+) KB", int) or rusage.ru_maxrss
+
+    return {"status": result, "length": length, "wall_time": round(wall_time, 6),
+            "search_time": search_time, "nodes_expanded": expanded,
+            "nodes_generated": generated, "nodes_per_sec": rate and round(rate, 1),
+            "peak_rss_kb": rss}
+
+
+def command_run(args):
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    options = ["--time-limit=%g" % args.time_limit]
+    if args.memory_limit:
+        options.append("--memory-limit=%d" % args.memory_limit)
+
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        for name, path in build_corpus(root, args.deals, directory):
+            for method in args.methods:
+                best = None
+                for _ in range(args.repeat):
+                    r = run_one(os.path.abspath(args.binary), method, path, options)
+                    if best is None or r["wall_time"] < best["wall_time"]:
+                        best = r
+                best = dict(method=method, puzzle=name, **best)
+                results.append(best)
+                print("%-8s %-24s %-8s len=%-5s %8.3fs %10s nodes %8d KB" % (
+                    method, name, best["status"], best["length"], best["wall_time"],
+                    best["nodes_expanded"], best["peak_rss_kb"]), flush=True)
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output + ".csv", "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(results)
+    with open(args.output + ".json", "w") as f:
+        json.dump({"host": platform.node(), "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+                   "options": options, "repeat": args.repeat, "results": results}, f, indent=1)
+    print("Results written to %s.csv and %s.json" % (args.output, args.output))
+    return 0
+
+
+def command_compare(args):
+    with open(args.base) as f:
+        base = {(r["method"], r["puzzle"]): r for r in json.load(f)["results"]}
+    with open(args.new) as f:
+        new = {(r["method"], r["puzzle"]): r for r in json.load(f)["results"]}
+
+    def worse(old, cur, slack=0.0):
+        return old is not None and cur is not None and cur > old * (1 + args.threshold) + slack
+
+    regressions = 0
+    print("%-8s %-24s %10s %10s %8s  %s" % ("method", "puzzle", "base", "new", "change", "flags"))
+    for key in sorted(base.keys() & new.keys()):
+        old, cur = base[key], new[key]
+        flags = []
+        if old["status"] == "solved" and cur["status"] != "solved":
+            flags.append("status " + cur["status"])
+        if worse(old["wall_time"], cur["wall_time"], args.noise):
+            flags.append("time")
+        if worse(old["nodes_expanded"], cur["nodes_expanded"]):
+            flags.append("nodes")
+        if worse(old["peak_rss_kb"], cur["peak_rss_kb"]):
+            flags.append("rss")
+        if old["length"] is not None and cur["length"] is not None and cur["length"] > old["length"]:
+            flags.append("length")
+        change = (cur["wall_time"] / old["wall_time"] - 1) * 100 if old["wall_time"] else 0.0
+        regressions += bool(flags)
+        print("%-8s %-24s %9.3fs %9.3fs %+7.1f%%  %s" % (key[0], key[1], old["wall_time"],
+              cur["wall_time"], change, "REGRESSION: " + ", ".join(flags) if flags else ""))
+
+    for key in sorted(base.keys() ^ new.keys()):
+        print("%-8s %-24s only in %s" % (key[0], key[1], "base" if key in base else "new"))
+    print("%d regression(s)" % regressions)
+    return 1 if regressions else 0
+
+
+def command_threads(args):
+    binary = os.path.abspath(args.binary)
+    options = ["--time-limit=%g" % args.time_limit]
+    # The time limit is checked by the solver itself, a run far past it is stuck.
+    kill_after = args.time_limit + 10
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for k in range(args.deals):
+            n = 3 + k % 4
+            name = "deal_%d_n%d.txt" % (k, n)
+            path = os.path.join(directory, name)
+            with open(path, "w") as f:
+                f.write(generate_deal(n, 2000 + k))
+            for method in args.methods:
+                serial = run_one(binary, method, path, options, kill_after)["status"]
+                statuses = []
+                for threads in args.threads:
+                    status = run_one(binary, method, path, options + ["--threads=%d" % threads],
+                                     kill_after)["status"]
+                    statuses.append(status)
+                    if status in ("hang", "crash") or (serial == "solved" and status != "solved"):
+                        failures += 1
+                        print("FAILED: %s %s --threads=%d gave %s, serial gave %s" % (
+                            method, name, threads, status, serial), flush=True)
+                print("%-8s %-16s serial %-8s threads %s" % (method, name, serial, " ".join(
+                    "%d:%s" % (t, s) for t, s in zip(args.threads, statuses))), flush=True)
+
+    print("%d failure(s)" % failures)
+    return 1 if failures else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="project_freecell benchmarks")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    run = sub.add_parser("run", help="run the benchmark suite")
+    run.add_argument("binary")
+    run.add_argument("output", help="output prefix (.csv and .json are added)")
+    run.add_argument("--methods", nargs="+", default=METHODS, choices=METHODS)
+    run.add_argument("--deals", type=int, default=8, help="number of generated deals")
+    run.add_argument("--repeat", type=int, default=3, help="runs per puzzle, the fastest is kept")
+    run.add_argument("--time-limit", type=float, default=10)
+    run.add_argument("--memory-limit", type=int, default=1024, help="MB, 0 for none")
+
+    compare = sub.add_parser("compare", help="compare two runs")
+    compare.add_argument("base")
+    compare.add_argument("new")
+    compare.add_argument("--threshold", type=float, default=0.10, help="relative slowdown flagged")
+    compare.add_argument("--noise", type=float, default=0.02, help="seconds of wall time ignored")
+
+    threads = sub.add_parser("threads", help="check the parallel search against the serial one")
+    threads.add_argument("binary")
+    threads.add_argument("--methods", nargs="+", default=["best", "astar"], choices=["best", "astar"])
+    threads.add_argument("--threads", nargs="+", type=int, default=[2, 3, 4])
+    threads.add_argument("--deals", type=int, default=12, help="number of generated deals")
+    threads.add_argument("--time-limit", type=float, default=10)
+
+    args = parser.parse_args()
+    commands = {"run": command_run, "compare": command_compare, "threads": command_threads}
+    return commands[args.command](args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
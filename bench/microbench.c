@@ -0,0 +1,533 @@
+// -------------------------------------------------------------
+//
+// Microbenchmarks of the hot kernels of project_freecell.c:
+// - next_child, building all the children of a node (and generate_moves, the first step)
+// - create_child (board copy plus move)
+// - equal_nodes
+// - heuristic and freestacks_count
+// - add_frontier_in_order
+// Every kernel runs over the fixed board positions of a positions file
+// (bench/positions.txt) and reports ns/op and allocations/op, the best of
+// a number of rounds.
+//
+// The solver is compiled in this file, so that its functions and its
+// thread-local state are reachable. Its main is renamed.
+//
+// Usage:
+//      microbench [positions-file] [rounds]
+//      microbench --record <positions-file> <puzzle-file>...
+//
+// --------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Every block malloc'ed by the solver is counted.
+unsigned long mallocs;
+
+void *counted_malloc(size_t size)
+{
+    mallocs++;
+    return malloc(size);
+}
+
+void *counted_calloc(size_t count, size_t size)
+{
+    mallocs++;
+    return calloc(count, size);
+}
+
+void *counted_realloc(void *block, size_t size)
+{
+    mallocs++;
+    return realloc(block, size);
+}
+
+#define malloc(size) counted_malloc(size)
+#define calloc(count, size) counted_calloc(count, size)
+#define realloc(block, size) counted_realloc(block, size)
+#define main project_freecell_main
+#include "../project_freecell.c"
+#undef main
+#undef malloc
+#undef calloc
+#undef realloc
+
+#define MAX_POSITIONS 1024
+#define DEFAULT_ROUNDS 200
+#define RECORD_WALKS 4   // Random walks recorded per puzzle.
+#define RECORD_STEPS 40  // Moves per walk.
+#define RECORD_EVERY 4   // A position is recorded every RECORD_EVERY moves.
+
+struct position {
+    int n;              // N of the position's puzzle.
+    struct board board; // The position.
+};
+
+struct position positions[MAX_POSITIONS];
+int positions_count;
+
+// Result of a kernel: the best time of a round and the allocations of a round.
+struct measure {
+    double fastest;            // Seconds of the fastest round.
+    unsigned long allocations; // Pool objects and malloc'ed blocks of a round.
+};
+
+// This function writes a position on a line: N, the 8 stacks, the freecells and
+// the foundations, separated by '|'.
+// Inputs:
+//      FILE *fout: Stream to write to
+//      struct board *board: The position
+void write_position(FILE *fout, struct board *board)
+{
+    int pos = 0;
+    fprintf(fout, "%d", N);
+    for (int i = 0; i < 8; i++) {
+        fprintf(fout, "|");
+        for (int j = 0; j < board->len[i]; j++, pos++) {
+            fprintf(fout, j > 0 ? " " : "");
+            print_card(fout, board->cards[pos]);
+        }
+    }
+    fprintf(fout, "|");
+    for (int i = 0, first = 1; i < 4; i++) {
+        if (board->freecells[i] != NO_CARD) {
+            fprintf(fout, first ? "" : " ");
+            print_card(fout, board->freecells[i]);
+            first = 0;
+        }
+    }
+    fprintf(fout, "|%d %d %d %d\n", board->foundations[HEARTS], board->foundations[SPADES],
+            board->foundations[DIAMONDS], board->foundations[CLUBS]);
+}
+
+// This function reads the positions of a positions file.
+// Inputs:
+//      char *filename: The positions file
+// Output:
+//      0 --> Successful read.
+//     -1 --> Unsuccessful read
+int read_positions(char *filename)
+{
+    FILE *fin = fopen(filename, "r");
+    if (fin == NULL) {
+        printf("Cannot open file %s.\n", filename);
+        return -1;
+    }
+
+    char *buffer = NULL;
+    size_t bufsize = 0;
+    while (getline(&buffer, &bufsize, fin) != -1 && positions_count < MAX_POSITIONS) {
+        if (buffer[0] == '#' || buffer[0] == '\n') {
+            continue;
+        }
+        struct position *p = &positions[positions_count++];
+        char *field = strtok(buffer, "|");
+        p->n = atoi(field);
+        generate_board(&p->board);
+        for (int i = 0; i < 8; i++) {
+            // Empty stacks are empty fields, so fields are split by hand.
+            field += strlen(field) + 1;
+            char *end = strchr(field, '|');
+            *end = '\0';
+            parse_stack(&p->board, i, field);
+        }
+        field += strlen(field) + 1;
+        char *end = strchr(field, '|');
+        *end = '\0';
+        // Freecell cards are parsed as a stack, then moved to the freecells.
+        struct board cells;
+        generate_board(&cells);
+        parse_stack(&cells, 0, field);
+        for (int i = 0; i < cells.len[0]; i++) {
+            p->board.freecells[i] = cells.cards[i];
+            p->board.hash ^= zobrist_freecell[cells.cards[i]];
+        }
+        int f[4];
+        sscanf(end + 1, "%d %d %d %d", &f[HEARTS], &f[SPADES], &f[DIAMONDS], &f[CLUBS]);
+        for (int i = 0; i < 4; i++) {
+            p->board.foundations[i] = f[i];
+        }
+    }
+    free(buffer);
+    fclose(fin);
+
+    return 0;
+}
+
+// This function records positions met by random walks from the puzzles of some
+// files into a positions file.
+// Inputs:
+//      char *output: The positions file
+//      int count: Number of puzzle files
+//      char **filenames: The puzzle files
+// Output:
+//      0 --> Successful write.
+//     -1 --> Cannot open the positions file
+int record_positions(char *output, int count, char **filenames)
+{
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    struct move_record moves[MAX_CHILDREN];
+    struct board puzzle, board;
+
+    FILE *fout = fopen(output, "w");
+    if (fout == NULL) {
+        printf("Cannot open file %s.\n", output);
+        return -1;
+    }
+    fprintf(fout, "# Positions for bench/microbench.c, recorded by random walks from:\n");
+    for (int f = 0; f < count; f++) {
+        fprintf(fout, "#   %s\n", filenames[f]);
+    }
+    for (int f = 0; f < count; f++) {
+        if (read_puzzle(filenames[f], &puzzle) < 0) {
+            continue;
+        }
+        for (int w = 0; w < RECORD_WALKS; w++) {
+            board = puzzle;
+            for (int step = 1; step <= RECORD_STEPS && !is_solution(&board); step++) {
+                int moves_count = generate_moves(&board, moves);
+                if (moves_count == 0) {
+                    break;
+                }
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                make_move(&board, &moves[(state >> 33) % moves_count]);
+                if (step % RECORD_EVERY == 0 && !is_solution(&board)) {
+                    write_position(fout, &board);
+                }
+            }
+        }
+    }
+    fclose(fout);
+
+    return 0;
+}
+
+// Returns the allocations made so far.
+unsigned long allocations()
+{
+    return mallocs + stats.allocations;
+}
+
+// Makes a root node for a position.
+// Inputs:
+//      struct tree_node *node: The node
+//      struct board *board: Its board
+void make_root(struct tree_node *node, struct board *board)
+{
+    memset(node, 0, sizeof(*node));
+    node->board = board;
+    node->heap_index = -1;
+    node->h = heuristic(board);
+    node->f = node->h;
+}
+
+// This function removes nodes from the transposition table, in the reverse order
+// of their insertion, which leaves the table as it was before, and gives them back
+// to their pools.
+// Inputs:
+//      struct tree_node **nodes: The nodes
+//      int count: Number of nodes
+void forget_nodes(struct tree_node **nodes, int count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        struct hash_slot *slot = find_slot(&visited, nodes[i]->board->hash, nodes[i]);
+        slot->node = NULL;
+        visited.count--;
+        pool_free(&board_pool, nodes[i]->board);
+        pool_free(&tree_pool, nodes[i]);
+    }
+}
+
+// This function times the expansion of every position as a best-first node: an op is
+// one position, start_children (generate_moves and generate_sequence_moves) followed
+// by next_child until no child is left. Each child goes through create_child: the
+// redundant-move check, the board copy, the move and auto_play, the dead_end check,
+// the pool allocations, the transposition-table insert and the heuristic. The
+// children are removed from the table again outside the timed part.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (the positions)
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_next_child(int rounds, int *ops)
+{
+    struct tree_node roots[MAX_POSITIONS];
+    struct tree_node *children[MAX_POSITIONS][MAX_CHILDREN];
+    struct child_iterator it;
+    int counts[MAX_POSITIONS];
+    struct measure m = {1e9, 0};
+
+    for (int i = 0; i < positions_count; i++) {
+        make_root(&roots[i], &positions[i].board);
+    }
+    *ops = positions_count;
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < positions_count; i++) {
+            N = positions[i].n;
+            start_children(&roots[i], best, &it);
+            counts[i] = 0;
+            while ((children[i][counts[i]] = next_child(&roots[i], best, &it, INT_MAX)) != NULL) {
+                counts[i]++;
+            }
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+        for (int i = positions_count - 1; i >= 0; i--) {
+            forget_nodes(children[i], counts[i]);
+        }
+    }
+
+    return m;
+}
+
+// This function times generate_moves alone: an op is listing the single-card moves
+// of one position, without copying a board or building a node.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (the positions)
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_generate_moves(int rounds, int *ops)
+{
+    struct move_record moves[MAX_CHILDREN];
+    struct measure m = {1e9, 0};
+    volatile int sum = 0;
+
+    *ops = positions_count;
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < positions_count; i++) {
+            sum += generate_moves(&positions[i].board, moves);
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+    }
+
+    return m;
+}
+
+// This function times create_child for every single-card move of every position:
+// an op is one move, i.e. the pool allocations, the board copy, the move and
+// auto_play, the dead_end check, the transposition-table insert and the best-first
+// heuristic. The moves are listed, and the children removed from the table again,
+// outside the timed part.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (the moves)
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_create_child(int rounds, int *ops)
+{
+    static struct tree_node *parents[MAX_POSITIONS * MAX_CHILDREN];
+    static struct move_record moves[MAX_POSITIONS * MAX_CHILDREN];
+    static struct tree_node *children[MAX_POSITIONS * MAX_CHILDREN];
+    struct tree_node roots[MAX_POSITIONS];
+    struct measure m = {1e9, 0};
+    int count = 0;
+
+    for (int i = 0; i < positions_count; i++) {
+        make_root(&roots[i], &positions[i].board);
+        int moves_count = generate_moves(&positions[i].board, &moves[count]);
+        for (int j = 0; j < moves_count; j++) {
+            parents[count++] = &roots[i];
+        }
+    }
+    *ops = count;
+    for (int r = 0; r < rounds; r++) {
+        int created = 0;
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < count; i++) {
+            struct tree_node *child = create_child(parents[i], moves[i].move, best, moves[i].from, moves[i].to);
+            if (child != NULL) {
+                children[created++] = child;
+            }
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+        forget_nodes(children, created);
+    }
+
+    return m;
+}
+
+// This function times equal_nodes: an op is one comparison of two boards, half of
+// them equal up to the order of their stacks and half of them (usually) different.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (two per position)
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_equal_nodes(int rounds, int *ops)
+{
+    struct tree_node nodes[MAX_POSITIONS];
+    struct tree_node copies[MAX_POSITIONS];
+    struct board boards[MAX_POSITIONS];
+    struct measure m = {1e9, 0};
+    volatile int equal = 0;
+
+    // Every position is compared with a copy of itself with its stacks in reverse
+    // order (equal) and with the next position (usually not equal).
+    for (int i = 0; i < positions_count; i++) {
+        struct board *b = &positions[i].board;
+        generate_board(&boards[i]);
+        for (int s = 7; s >= 0; s--) {
+            int start = stack_start(b, s);
+            for (int j = 0; j < b->len[s]; j++) {
+                push_card(&boards[i], 7 - s, b->cards[start + j]);
+            }
+        }
+        memcpy(boards[i].freecells, b->freecells, 4);
+        memcpy(boards[i].foundations, b->foundations, 4);
+        make_root(&nodes[i], b);
+        make_root(&copies[i], &boards[i]);
+    }
+    *ops = 2 * positions_count;
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < positions_count; i++) {
+            equal += equal_nodes(&nodes[i], &copies[i]);
+            equal += equal_nodes(&nodes[i], &nodes[(i + 1) % positions_count]);
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+    }
+
+    return m;
+}
+
+// This function times a function evaluating a board (heuristic or freestacks_count):
+// an op is one call on one position.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (the positions)
+//      int (*kernel)(struct board*): The function timed
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_heuristic(int rounds, int *ops, int (*kernel)(struct board*))
+{
+    struct measure m = {1e9, 0};
+    volatile int sum = 0;
+
+    *ops = positions_count;
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < positions_count; i++) {
+            N = positions[i].n;
+            sum += kernel(&positions[i].board);
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+    }
+
+    return m;
+}
+
+// This function times add_frontier_in_order on the children of every position: an
+// op is one insertion into the frontier heap, which grows to hold all of them. The
+// heap array is only reallocated in the first round; the children are built outside
+// the timed part.
+// Inputs:
+//      int rounds: Number of rounds, the fastest is kept
+//      int *ops: Set to the ops of a round (the children)
+// Output:
+//      The fastest round and the allocations of a round
+struct measure bench_add_frontier_in_order(int rounds, int *ops)
+{
+    static struct tree_node nodes[MAX_POSITIONS * MAX_CHILDREN];
+    struct measure m = {1e9, 0};
+    int count = 0;
+
+    // The children of all positions, so that f values spread like in a search.
+    for (int i = 0; i < positions_count; i++) {
+        struct move_record moves[MAX_CHILDREN];
+        int moves_count = generate_moves(&positions[i].board, moves);
+        for (int j = 0; j < moves_count; j++) {
+            struct board *b = (struct board*) pool_alloc(&board_pool);
+            *b = positions[i].board;
+            execute_move(b, moves[j].move, moves[j].from, moves[j].to);
+            N = positions[i].n;
+            make_root(&nodes[count++], b);
+        }
+    }
+    *ops = count;
+    for (int r = 0; r < rounds; r++) {
+        frontier_heap.count = 0;
+        unsigned long a = allocations();
+        double t = wall_clock();
+        for (int i = 0; i < count; i++) {
+            add_frontier_in_order(&nodes[i]);
+        }
+        t = wall_clock() - t;
+        m.allocations = allocations() - a;
+        m.fastest = t < m.fastest ? t : m.fastest;
+    }
+    frontier_heap.count = 0;
+
+    return m;
+}
+
+void report(char *name, struct measure m, int ops)
+{
+    printf("%-24s %10.1f ns/op %8.2f allocs/op %8d ops\n", name, m.fastest * 1e9 / ops,
+           (double) m.allocations / ops, ops);
+}
+
+int main(int argc, char **argv)
+{
+    char *filename = "bench/positions.txt";
+    int rounds = DEFAULT_ROUNDS;
+    struct measure m;
+    int ops;
+
+    init_zobrist();
+    if (argc > 2 && strcmp(argv[1], "--record") == 0) {
+        return record_positions(argv[2], argc - 3, argv + 3);
+    }
+    if (argc > 1) {
+        filename = argv[1];
+    }
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+    if (read_positions(filename) < 0 || positions_count == 0 || init_hash_table(&visited, 1 << 16) < 0) {
+        return -1;
+    }
+
+    printf("%d positions, best of %d rounds\n", positions_count, rounds);
+    m = bench_next_child(rounds, &ops);
+    report("next_child", m, ops);
+    m = bench_generate_moves(rounds, &ops);
+    report("  generate_moves", m, ops);
+    m = bench_create_child(rounds, &ops);
+    report("create_child", m, ops);
+    m = bench_equal_nodes(rounds, &ops);
+    report("equal_nodes", m, ops);
+    m = bench_heuristic(rounds, &ops, heuristic);
+    report("heuristic", m, ops);
+    m = bench_heuristic(rounds, &ops, freestacks_count);
+    report("freestacks_count", m, ops);
+    m = bench_add_frontier_in_order(rounds, &ops);
+    report("add_frontier_in_order", m, ops);
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+// -------------------------------------------------------------
+//
+// Generator of the pattern database of project_freecell.c (see pdb_cost).
+// An abstract state is one suit reduced to its window, the next PDB_WINDOW
+// cards to go home, with the other cards removed. Each window card is at a
+// freecell, at home, or in a stack, where only the nearest window card below
+// it is kept. With the other cards gone, a card can always be parked, so a
+// move takes the top window card of a stack or a freecell card:
+// - home, once the window cards below its value are home
+// - to a freecell
+// - to an empty stack
+// The database holds the fewest moves bringing every window card home, for
+// every abstract state, computed backwards from the solved state.
+//
+// The solver is compiled in this file, so that the database layout is
+// shared. Its main is renamed.
+//
+// Usage:
+//      generate_pdb [output-file]
+//
+// --------------------------------------------------------------
+
+#define main project_freecell_main
+#include "../project_freecell.c"
+#undef main
+
+// Decodes the index of an abstract state into the codes of its window cards.
+// Inputs:
+//      int index: The index
+//      int *codes: The codes (PDB_WINDOW codes)
+void decode_state(int index, int *codes)
+{
+    for (int i = 0; i < PDB_WINDOW; i++) {
+        codes[i] = index % PDB_RADIX;
+        index /= PDB_RADIX;
+    }
+}
+
+// Checks that an abstract state is a layout of cards: every stacked card lies on
+// a stacked card, at most one card lies on each, and there is no cycle.
+// Inputs:
+//      int *codes: The codes of the window cards
+// Output:
+//      1 --> Valid state
+//      0 --> No board maps to this state
+int valid_state(int *codes)
+{
+    int covered[PDB_WINDOW] = {0};
+
+    for (int i = 0; i < PDB_WINDOW; i++) {
+        if (codes[i] >= 1 && codes[i] <= PDB_WINDOW) {
+            int below = codes[i] - 1;
+            if (below == i || codes[below] == PDB_FREECELL || codes[below] == PDB_HOME || covered[below]) {
+                return 0;
+            }
+            covered[below] = 1;
+        }
+    }
+    // Following the cards below, a stacked card reaches a bottom within PDB_WINDOW steps.
+    for (int i = 0; i < PDB_WINDOW; i++) {
+        int c = i, steps = 0;
+        while (codes[c] >= 1 && codes[c] <= PDB_WINDOW && steps <= PDB_WINDOW) {
+            c = codes[c] - 1;
+            steps++;
+        }
+        if (steps > PDB_WINDOW) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Lists the abstract states one move away from a state.
+// Inputs:
+//      int *codes: The codes of the window cards
+//      int *next: The indexes of the states (3 * PDB_WINDOW at most)
+// Output:
+//      int --> Number of states
+int next_states(int *codes, int *next)
+{
+    int count = 0;
+
+    for (int i = 0; i < PDB_WINDOW; i++) {
+        if (codes[i] == PDB_HOME) {
+            continue;
+        }
+        // Only a card with no window card on it moves.
+        int top = 1;
+        for (int j = 0; j < PDB_WINDOW; j++) {
+            if (codes[j] == i + 1) {
+                top = 0;
+            }
+        }
+        if (!top) {
+            continue;
+        }
+
+        int code = codes[i];
+        int home = 1;
+        for (int j = 0; j < i; j++) {
+            if (codes[j] != PDB_HOME) {
+                home = 0;
+            }
+        }
+        if (home) {
+            codes[i] = PDB_HOME;
+            next[count++] = pdb_index(codes);
+        }
+        if (code != PDB_FREECELL) {
+            codes[i] = PDB_FREECELL;
+            next[count++] = pdb_index(codes);
+        }
+        if (code != PDB_BOTTOM) {
+            codes[i] = PDB_BOTTOM;
+            next[count++] = pdb_index(codes);
+        }
+        codes[i] = code;
+    }
+
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    char *filename = argc > 1 ? argv[1] : "freecell.pdb";
+    struct pdb_header header;
+    int codes[PDB_WINDOW];
+    int next[3 * PDB_WINDOW];
+    int changed, moves;
+
+    unsigned char *table = (unsigned char*) malloc(PDB_ENTRIES);
+    unsigned char *valid = (unsigned char*) malloc(PDB_ENTRIES);
+    if (table == NULL || valid == NULL) {
+        printf("Memory exhausted.\n");
+        return -1;
+    }
+    for (int i = 0; i < PDB_ENTRIES; i++) {
+        decode_state(i, codes);
+        valid[i] = valid_state(codes);
+        table[i] = PDB_UNKNOWN;
+    }
+    for (int i = 0; i < PDB_WINDOW; i++) {
+        codes[i] = PDB_HOME;
+    }
+    table[pdb_index(codes)] = 0;
+
+    // Every round sets the states one move further from home than the last one.
+    for (moves = 1, changed = 1; changed; moves++) {
+        changed = 0;
+        for (int i = 0; i < PDB_ENTRIES; i++) {
+            if (!valid[i] || table[i] != PDB_UNKNOWN) {
+                continue;
+            }
+            decode_state(i, codes);
+            int count = next_states(codes, next);
+            for (int j = 0; j < count; j++) {
+                if (table[next[j]] == moves - 1) {
+                    table[i] = moves;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    int states = 0;
+    for (int i = 0; i < PDB_ENTRIES; i++) {
+        if (valid[i]) {
+            states++;
+            if (table[i] == PDB_UNKNOWN) {
+                printf("Abstract state %d cannot be solved.\n", i);
+                return -1;
+            }
+        }
+    }
+
+    FILE *fout = fopen(filename, "wb");
+    if (fout == NULL) {
+        printf("Cannot open output file %s.\n", filename);
+        return -1;
+    }
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, PDB_MAGIC);
+    header.window = PDB_WINDOW;
+    header.entries = PDB_ENTRIES;
+    if (fwrite(&header, sizeof(header), 1, fout) != 1 || fwrite(table, PDB_ENTRIES, 1, fout) != 1
+        || fclose(fout) != 0) {
+        printf("Cannot write output file %s.\n", filename);
+        return -1;
+    }
+    printf("%d abstract states, at most %d moves from home, written to %s.\n", states, moves - 2, filename);
+
+    free(table);
+    free(valid);
+    return 0;
+}
@@ -1,10 +1,12 @@
 // -------------------------------------------------------------
 //
-// This program solves freecell solitaire puzzles using four algorithms:
+// This program solves freecell solitaire puzzles using six algorithms:
 // - Depth first search
 // - Breadth first search
 // - Best first search
 // - A*
+// - Iterative deepening A*
+// - Beam search
 // N is defined as a constant.
 // Puzzles are read from an input file, while solution is written
 // to an output file.
@@ -17,19 +19,31 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 // Enable DEBUG mode
 //#define DEBUG
-// Constants denoting the four algorithms.
+// Constants denoting the six algorithms.
 #define breadth     1
 #define depth       2
 #define best        3
 #define astar       4
-// Constants denoting the four moves.
+#define idastar     5
+#define beam        6
+// Constants denoting the five moves.
 #define foundation  0
 #define newstack    1        
 #define stack       2
 #define freecell    3
+#define sequence    4        // A run of cards moved at once (search trees only, see move_run).
 // Constants denoting the four suits.
 #define HEARTS      0
 #define SPADES      1
@@ -37,25 +51,129 @@
 #define CLUBS       3
 
 // Max card number, provided by the first line of input file
-int N;
+// (per thread, since batch mode solves puzzles of any size at once).
+_Thread_local int N;
 
-// Cart structure.
-struct card {
-    int suit;
-    int value;
+// Max number of cards a deal can hold (four suits of at most 13 values).
+#define MAX_CARDS   52
+// Marks an empty freecell or a missing card.
+#define NO_CARD     0xFF
+
+// Cards are packed in a single byte: the value in the upper six bits,
+// the suit in the lower two. Hearts and diamonds (even suits) are red.
+#define make_card(suit, value) ((unsigned char)(((value) << 2) | (suit)))
+#define card_suit(c)           ((c) & 3)
+#define card_value(c)          ((c) >> 2)
+#define card_is_red(c)         (((c) & 1) == 0)
+
+// Card masks hold a bit per card byte (bit c for card c, see make_card).
+#define card_bit(c) (1ULL << (c))
+
+// The cards each card can be stacked on: one value higher, of the other colour.
+// A red card fits on the spade and the club of the next value, a black card on
+// the heart and the diamond.
+#define TARGETS_OF_VALUE(v) (0xAULL << 4 * ((v) + 1)), (0x5ULL << 4 * ((v) + 1)), \
+                            (0xAULL << 4 * ((v) + 1)), (0x5ULL << 4 * ((v) + 1))
+static const unsigned long long card_targets[MAX_CARDS] = {
+    TARGETS_OF_VALUE(0), TARGETS_OF_VALUE(1), TARGETS_OF_VALUE(2), TARGETS_OF_VALUE(3),
+    TARGETS_OF_VALUE(4), TARGETS_OF_VALUE(5), TARGETS_OF_VALUE(6), TARGETS_OF_VALUE(7),
+    TARGETS_OF_VALUE(8), TARGETS_OF_VALUE(9), TARGETS_OF_VALUE(10), TARGETS_OF_VALUE(11),
+    TARGETS_OF_VALUE(12)
+};
+
+// Whether card c can be stacked on card target (neither of them NO_CARD).
+#define card_fits(c, target) ((card_targets[c] >> (target)) & 1)
+
+// Packed board structure.
+// The stacks are stored one after the other in cards[], each one from its
+// bottom to its top card, so only len[] is needed to locate them. Bytes past
+// the last stacked card are always NO_CARD, so two boards brought to their
+// canonical form (see canonicalize_board) can be compared with a plain memcmp.
+struct board {
+    unsigned long long hash;        // Zobrist hash of the board, kept up to date by every move.
+    unsigned char cards[MAX_CARDS]; // The cards of the 8 stacks.
+    unsigned char len[8];           // Number of cards in each stack.
+    unsigned char freecells[4];     // The card in each freecell (NO_CARD if free).
+    unsigned char foundations[4];   // Number of cards at the foundation of each suit.
 };
 
+// Zobrist keys. A stacked card is keyed by the card it lies on, a freecell card by
+// the card alone, so the hash does not depend on the order of the stacks or of the
+// freecells. Foundations need no keys, since the cards found there are exactly
+// those missing from the rest of the board.
+unsigned long long zobrist_stack[MAX_CARDS][MAX_CARDS + 1]; // Card lying on a card (MAX_CARDS: stack bottom).
+unsigned long long zobrist_freecell[MAX_CARDS];             // Card at a freecell.
+
 // Tree's node structure.
 struct tree_node {
-    struct card board[16][52];
-    int tops[16];
+    struct board *board;            // The board (NULL for delta-encoded nodes, see node_board).
     int h;                          // The value of the heuristic function for this node.
-    int g;                          // The depth of this node .
+    int g;                          // The moves from the root: its ancestors', its own and those of auto_play.
     int f;                          // f=0 or f=h or f=h+g, depending on the search algorithm used.
-    struct tree_node *parent;       // Pointer to the parrent node (NULL for the root).
     int move;                       // The last move.
-    struct card moved0, moved1;     // The card moved and the one it landed on if used stack.
-    struct tree_node *children[20]; // Pointer to a table with 20 pointers to the childerns (NULL if no child).
+    struct tree_node *parent;       // Pointer to the parrent node (NULL for the root).
+    unsigned char moved0, moved1;   // The card moved (lowest of a sequence) and the one it landed on if used stack.
+    unsigned char under;            // The card the moved card lay on (see move_record).
+    unsigned short children;        // Number of children still in the tree (memory-bounded mode only).
+    int heap_index;                 // Position in the frontier heap (-1 if not in it).
+    unsigned int seq;               // Insertion order in the frontier heap, breaking (f, h) ties.
+};
+
+// Max number of sequence moves of a board: onto each of the 8 top cards, from the
+// two cards that fit on it, plus one to an empty stack from each stack.
+#define MAX_SEQUENCE_MOVES 24
+
+// Max number of children generated by a single expansion.
+#define MAX_CHILDREN (20 + MAX_SEQUENCE_MOVES)
+
+// Max number of single-card steps a node's move may stand for: the steps of a
+// sequence (see move_run), then the cards sent to the foundations (see auto_play).
+#define MAX_STEPS (2 * MAX_CARDS)
+
+// Move structure.
+// A legal move of a board, as listed by generate_moves. When executed in place by
+// make_move, it also records the exact slots used, so that unmake_move can undo it.
+struct move_record {
+    unsigned char move;   // The kind of move (foundation, newstack, stack or freecell).
+    unsigned char from;   // Stack (0-7) or freecell (8-11) moved from.
+    unsigned char to;     // Stack (0-7), freecell (8-11) or foundation (12-15) moved to.
+    unsigned char moved0; // The card moved.
+    unsigned char moved1; // The card it landed on if used stack (NO_CARD otherwise).
+    unsigned char under;  // The card it lay on (NO_CARD: a stack bottom, FROM_FREECELL: a freecell), set by make_move.
+};
+
+// Marks a card moved from a freecell (see move_record).
+#define FROM_FREECELL 0xFE
+
+// Move iterator structure.
+// Lists the legal moves of a board one at a time (see next_move), in the reverse of
+// the generate_moves order. The board may change between two calls, as long as it
+// has been restored.
+struct move_iterator {
+    signed char from;    // Stack (0-7) or freecell (8-11) moved from, counting down.
+    signed char to;      // Next stack tried as a target, counting down.
+    unsigned char phase; // Next kind of move tried for this source.
+};
+
+// Move index structure.
+// The places of a board that its moves depend on (see index_board), with the cards
+// as masks (see card_bit), so that the stacks a card can go to come from a single
+// AND with its card_targets.
+struct move_index {
+    unsigned char top[12];             // Top card of each stack and freecell card (NO_CARD if none).
+    unsigned long long tops;           // The top cards of the stacks.
+    unsigned long long home;           // The cards that can go to their foundation.
+    signed char free_cell;             // The first free freecell (8-11), -1 if none.
+    unsigned char stack_of[MAX_CARDS]; // The stack of each top card.
+};
+
+// Child iterator structure.
+// Builds the children of a search-tree node one at a time (see next_child). Only its
+// moves are listed up front: the board of a child is copied when the child is asked for.
+struct child_iterator {
+    struct move_record moves[MAX_CHILDREN]; // The legal moves of the node's board.
+    int count;                              // Number of moves.
+    int next;                               // The next move to build a child from.
 };
 
 // Frontier's node structure.
@@ -65,28 +183,240 @@ struct frontier_node {
     struct frontier_node *next;     // Pointer to the next frontier node.
 };
 
-struct frontier_node *frontier_head = NULL; // The one end of the frontier.
-struct frontier_node *frontier_tail = NULL; // The other end of the frontier.
+// Slab allocator structure.
+// Objects of a single size are carved out of large slabs instead of being
+// malloc'ed one by one. Released objects go to a free list for reuse, and all
+// slabs are given back at once by pool_release.
+struct pool {
+    size_t object_size; // Size of the objects (a multiple of the pointer size).
+    void *free_list;    // Last released object (each one points to the previously released).
+    char *slab;         // Current slab (its first bytes point to the previous slab).
+    size_t used;        // Bytes used in the current slab.
+    size_t slabs;       // Number of slabs allocated.
+    size_t spare;       // Number of objects in the free list.
+};
+
+#define SLAB_SIZE (1 << 20) // Bytes allocated per slab.
+#define SLAB_HEADER 16      // Bytes reserved at the start of a slab, keeping objects aligned.
+
+// The search state below is thread-local: every worker of the parallel search
+// (see parallel_search) has its own pools, frontier and transposition table.
+_Thread_local struct pool tree_pool = {sizeof(struct tree_node), NULL, NULL, SLAB_SIZE, 0, 0};         // Search-tree nodes.
+_Thread_local struct pool frontier_pool = {sizeof(struct frontier_node), NULL, NULL, SLAB_SIZE, 0, 0}; // Frontier list nodes.
+_Thread_local struct pool board_pool = {sizeof(struct board), NULL, NULL, SLAB_SIZE, 0, 0};            // Boards of the tree nodes.
+
+// In delta mode, expanded nodes only keep the move leading to them and drop their
+// board, except at every checkpoint_interval levels. Set by the --delta option.
+int checkpoint_interval = 0;
+#define DEFAULT_CHECKPOINT_INTERVAL 8
+
+// In memory-bounded mode, best and astar drop the worst boards of the frontier
+// instead of failing at the memory limit (see forget_frontier). Set by the
+// --memory-bounded option.
+int memory_bounded = 0;
+
+_Thread_local struct frontier_node *frontier_head = NULL; // The one end of the frontier.
+_Thread_local struct frontier_node *frontier_tail = NULL; // The other end of the frontier.
+
+// Priority frontier structure, used by the heuristic search algorithms.
+// An indexed binary heap with the node of the largest f on top. Ties are broken
+// by the largest h and then by the most recently added node.
+struct frontier_heap {
+    struct tree_node **nodes; // The heap table.
+    int count;                // Number of nodes in the heap.
+    int capacity;             // Number of nodes the table can hold.
+    unsigned int seq;         // Number of insertions so far.
+};
+
+_Thread_local struct frontier_heap frontier_heap; // The frontier of best and astar.
+
+// Transposition table structure.
+// An open addressing hash table (linear probing) holding every search-tree node
+// generated so far, keyed by the Zobrist hash of its board.
+struct hash_slot {
+    unsigned long long hash; // Hash of the node's board.
+    struct tree_node *node;  // Pointer to the node (NULL if the slot is empty).
+};
+
+struct hash_table {
+    struct hash_slot *slots; // Table of slots.
+    unsigned long size;      // Number of slots, always a power of two.
+    unsigned long count;     // Number of nodes stored.
+};
+
+_Thread_local struct hash_table visited; // Every board met during the search.
+
+double t1;          // Start time of the search algorithm (wall clock).
+double t2;          // End time of the search algorithm (wall clock).
+#define TIMEOUT 300 // Default time limit of a search, in secs.
+
+// Budgets of a single search. Set by the --time-limit, --memory-limit, --max-nodes
+// and --max-rss options. The search loops poll them every POLL_INTERVAL boards (and
+// when the node budget is reached).
+double time_limit = TIMEOUT; // Seconds a search may run.
+size_t memory_limit = 0;     // Bytes the search structures of a thread may take (0 for no limit).
+unsigned long max_nodes = 0; // Boards a search may expand (0 for no limit).
+size_t max_rss = 0;          // Bytes the resident set of the process may take (0 for no limit).
+#define POLL_INTERVAL 1024   // Boards expanded between two budget checks (a power of two).
+#define IDLE_POLL_SECS 0.01  // Seconds between two budget checks of an idle parallel worker.
+
+// Constants denoting why a search stopped before its end (see budget_exceeded).
+#define STOP_NONE   0
+#define STOP_TIME   1
+#define STOP_NODES  2
+#define STOP_RSS    3
+#define STOP_DISK   4        // The external search could not write or read its files.
+
+// Per-search state, thread-local so that batch mode can solve puzzles concurrently.
+_Thread_local double search_deadline;       // Wall-clock time at which the search gives up.
+_Thread_local int stop_reason;              // The budget that stopped the search (STOP_NONE if none).
+_Thread_local int budget_share = 1;         // Number of threads sharing the node budget.
+_Thread_local unsigned long next_poll;      // Boards expanded at the next budget check.
+
+// Search statistics structure. Times are only measured with the --stats option.
+struct search_stats {
+    unsigned long expanded;    // Boards expanded.
+    unsigned long generated;   // Boards generated (duplicates included).
+    unsigned long duplicates;  // Boards pruned as already met (or already on the path).
+    unsigned long frontier;    // Current frontier length (path length for depth and idastar).
+    unsigned long max_frontier; // Largest frontier length.
+    size_t bytes_allocated;    // Bytes allocated for nodes, boards, frontier and transposition table.
+    unsigned long allocations; // Objects taken from the pools.
+    double move_time;          // Time spent generating moves and child boards.
+    double visited_time;       // Time spent looking children up in the transposition table.
+    double evaluation_time;    // Time spent evaluating children.
+    double insertion_time;     // Time spent adding children to the frontier.
+    unsigned long forgotten;   // Boards dropped from the frontier by the memory-bounded mode.
+    unsigned long dead_ends;   // Boards pruned as unsolvable (see dead_end).
+    unsigned long redundant;   // Moves skipped as redundant (see redundant_move).
+};
+
+_Thread_local struct search_stats stats; // Statistics of the current search.
+int stats_format = 0;                    // 0: none, 1: text, 2: JSON. Set by the --stats option.
+
+_Thread_local int solution_length;        // The lenght of the solution table.
+_Thread_local int *solution;              // Pointer to a dynamic table with the moves of the solution.
+_Thread_local unsigned char *sol_moved0;  // Pointer to a dynamic table with the moved cards of the solution.
+_Thread_local unsigned char *sol_moved1;  // Pointer to a dynamic table with the cards the moved card landed if used stack.
+
+// Path set structure.
+// An open addressing hash table (linear probing) of the board hashes found on the
+// current path of the depth-first engine, supporting removals.
+struct path_set {
+    unsigned long long *keys; // Board hashes.
+    unsigned char *used;      // Whether each slot holds a hash.
+    unsigned long size;       // Number of slots, always a power of two.
+    unsigned long count;      // Number of hashes stored.
+};
+
+// IDA* state. The search runs on a single board; only the path from the root is stored.
+_Thread_local struct move_record *ida_moves;   // Moves of the current path.
+_Thread_local unsigned long long *ida_hashes;  // Hashes of the boards of the current path, for loop detection.
+_Thread_local int ida_capacity;                // Length of the above tables.
+#define IDA_MOVE_COST 10         // The cost of a move, in heuristic units (a card at foundations is worth 10).
+
+// External-memory breadth-first search (see external_search).
+char *external_dir = NULL;         // Directory of the layer files, set by the --external option (NULL: off).
+#define EXTERNAL_BUFFER (64 << 20) // Bytes of children sorted in memory at once (at most --memory-limit).
+_Thread_local int external_key;    // Bytes of the board key of an external record (4N + 16).
+_Thread_local int external_record; // Bytes of an external record (the key and the move).
+atomic_int external_count;         // Number of external searches so far, naming their files.
+
+// Beam search (see beam_search).
+#define DEFAULT_BEAM_WIDTH 100
+int beam_width = DEFAULT_BEAM_WIDTH;     // Boards kept per level, set by the --beam-width option.
+
+// Anytime weighted A* (see anytime_search).
+int anytime = 0;                         // Starting weight of the heuristic, set by the --anytime option (0: off).
+#define DEFAULT_ANYTIME_WEIGHT 5
+_Thread_local int search_weight;         // Current weight of the heuristic (0: the plain astar evaluation).
+char *anytime_output = NULL;             // File each improved solution is written to (NULL: none).
+
+// Pattern database heuristic (see pdb_cost).
+// The database is a file holding a header and the table, one byte per abstract
+// state. It is built by pdb/generate_pdb.c and mapped in memory as it is.
+struct pdb_header {
+    char magic[8];         // PDB_MAGIC.
+    unsigned int window;   // PDB_WINDOW of the generator.
+    unsigned int entries;  // Number of bytes of the table following the header.
+};
+#define PDB_MAGIC "FCPDB01"
+#define PDB_WINDOW 6                    // Cards of a suit in an abstract state: the next ones to go home.
+#define PDB_BOTTOM 0                    // Code of a card with no window card below it in its stack.
+#define PDB_FREECELL (PDB_WINDOW + 1)   // Code of a card at a freecell (codes 1..PDB_WINDOW: the window card below it).
+#define PDB_HOME (PDB_WINDOW + 2)       // Code of a card at the foundations (or beyond N).
+#define PDB_RADIX (PDB_WINDOW + 3)      // Number of codes.
+#define PDB_ENTRIES 531441              // Size of the table: PDB_RADIX to the power PDB_WINDOW.
+#define PDB_UNKNOWN 0xFF                // Table entry of a state no board maps to.
+char *pdb_file = NULL;                  // The database file, set by the --pdb option (NULL: none).
+unsigned char *pdb_table = NULL;        // The mapped table (NULL if no database is loaded).
+
+_Thread_local int mem_error; // Constant for errors while allocating memory. If mem_error -1 programm exhausted all available memory and terminates. 
 
-clock_t t1;         // Start time of the search algorithm.
-clock_t t2;         // End time of the search algorithm.
-#define TIMEOUT 300 // Program terminates after TIMOUT secs.
+// Worker structure of the parallel search (HDA*). Every board is owned by one
+// worker, chosen by its hash, which keeps it in its own transposition table and
+// frontier. Children owned by another worker are sent to its inbox.
+struct hda_worker {
+    pthread_t thread;                     // The worker's thread.
+    int id;                               // Index of the worker.
+    _Atomic(struct frontier_node*) inbox; // Nodes sent by the other workers (a lock-free stack linked by next).
+    struct pool pools[3];                 // The worker's tree, frontier and board pools, kept after it exits.
+    int mem_error;                        // The worker's mem_error when it exited.
+    int stop_reason;                      // The worker's stop_reason when it exited.
+    struct search_stats stats;            // The worker's statistics.
+};
+
+int threads = 1;                                // Number of workers of best and astar. Set by the --threads option.
+struct hda_worker *hda_workers;                 // The workers of the parallel search.
+struct board *hda_puzzle;                       // The puzzle being solved.
+int hda_method;                                 // The search algorithm (best or astar).
+int hda_n;                                      // N of the puzzle being solved.
+double hda_start;                               // Wall-clock start time of the parallel search.
+atomic_long hda_active;                         // Busy workers plus nodes sent and not yet received.
+atomic_int hda_stop;                            // Set when the workers must stop.
+_Atomic(struct tree_node*) hda_solution;        // The solution node found by the workers.
 
-int solution_length;     // The lenght of the solution table.
-int *solution;           // Pointer to a dynamic table with the moves of the solution.
-struct card *sol_moved0; // Pointer to a dynamic table with the moved cards of the solution.
-struct card *sol_moved1; // Pointer to a dynamic table with the cards the moved card landed if used stack.
+// Batch mode: the input is a directory or a file holding many puzzles, solved
+// concurrently by --threads workers, with a result line per puzzle.
+struct batch_puzzle {
+    char *name;         // The file the puzzle was read from.
+    int index;          // Position of the puzzle in its file (from 1).
+    int n;              // N of the puzzle.
+    struct board board; // The puzzle.
+};
 
-int mem_error; // Constant for errors while allocating memory. If mem_error -1 programm exhausted all available memory and terminates. 
+int batch = 0;                      // Set by the --batch option.
+struct batch_puzzle *batch_puzzles; // The puzzles to solve.
+int batch_count;                    // Number of puzzles.
+int batch_capacity;                 // Number of puzzles the table can hold.
+int batch_method;                   // The search algorithm.
+atomic_int batch_next;              // Next puzzle to hand to a worker.
+atomic_int batch_solved;            // Number of puzzles solved.
+FILE *batch_out;                    // The results stream.
+pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes the result lines.
 
 // Auxiliary function that displays a message in case of wrong input parameters.
 void syntax_message()
 {
-    printf("project_freecell <method> <input-file> <output-file>\n\n");
+    printf("project_freecell [options] <method> <input-file> <output-file>\n\n");
     printf("where: ");
-    printf("<method> = breadth|depth|best|astar\n");
+    printf("<method> = breadth|depth|best|astar|idastar|beam\n");
     printf("<input-file> is a file containing a %dx%d puzzle description.\n", N, N);
     printf("<output-file> is the file where the solution will be written.\n");
+    printf("options:\n");
+    printf("--delta[=K] expanded nodes keep only their last move, plus a full board every K levels (default %d).\n", DEFAULT_CHECKPOINT_INTERVAL);
+    printf("--threads=N best and astar run N workers in parallel (default 1); in batch mode, N puzzles are solved at once.\n");
+    printf("--batch <input-file> is a directory or a file of puzzles, <output-file> gets a result line per puzzle.\n");
+    printf("--time-limit=S a search gives up after S secs (default %d).\n", TIMEOUT);
+    printf("--stats[=json] print search statistics, as text or as a JSON object.\n");
+    printf("--memory-limit=MB a search gives up when its nodes, frontier and table take MB megabytes.\n");
+    printf("--max-nodes=N a search gives up after expanding N boards.\n");
+    printf("--max-rss=MB a search gives up when the process takes MB megabytes of resident memory.\n");
+    printf("--beam-width=K beam keeps the K best boards of every level (default %d).\n", DEFAULT_BEAM_WIDTH);
+    printf("--external[=DIR] breadth keeps its layers in sorted files in DIR (default the current directory).\n");
+    printf("--memory-bounded best and astar forget their worst boards at the memory limit instead of failing.\n");
+    printf("--pdb[=FILE] astar and idastar use the pattern database FILE (default freecell.pdb), built by make pdb.\n");
+    printf("--anytime[=W] astar starts with heuristic weight W (default %d) and keeps improving its solution.\n", DEFAULT_ANYTIME_WEIGHT);
 }
 
 // Reading run-time parameters.
@@ -102,39 +432,321 @@ int get_method(char *s)
         return best;
     } else if (strcmp(s, "astar") == 0) {
         return astar;
+    } else if (strcmp(s, "idastar") == 0) {
+        return idastar;
+    } else if (strcmp(s, "beam") == 0) {
+        return beam;
     }
     
     return -1;
 }
 
+// Returns the name of a search algorithm.
+// Inputs:
+//      int method: Execution algorithm.
+char *method_name(int method)
+{
+    static char *names[] = {"", "breadth", "depth", "best", "astar", "idastar", "beam"};
+
+    return names[method];
+}
+
+// Reading run-time options.
+// Inputs:
+//      char *s: Option string
+// Output:
+//      0 --> Valid option
+//     -1 --> Unknown or malformed option
+int get_option(char *s)
+{
+    if (strcmp(s, "--delta") == 0) {
+        checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+        return 0;
+    } else if (strncmp(s, "--delta=", 8) == 0) {
+        checkpoint_interval = atoi(s + 8);
+        return checkpoint_interval > 0 ? 0 : -1;
+    } else if (strncmp(s, "--threads=", 10) == 0) {
+        threads = atoi(s + 10);
+        return threads > 0 ? 0 : -1;
+    } else if (strcmp(s, "--stats") == 0) {
+        stats_format = 1;
+        return 0;
+    } else if (strcmp(s, "--stats=json") == 0) {
+        stats_format = 2;
+        return 0;
+    } else if (strcmp(s, "--batch") == 0) {
+        batch = 1;
+        return 0;
+    } else if (strncmp(s, "--time-limit=", 13) == 0) {
+        time_limit = atof(s + 13);
+        return time_limit > 0 ? 0 : -1;
+    } else if (strncmp(s, "--memory-limit=", 15) == 0) {
+        memory_limit = (size_t) atol(s + 15) << 20;
+        return memory_limit > 0 ? 0 : -1;
+    } else if (strncmp(s, "--max-nodes=", 12) == 0) {
+        max_nodes = strtoul(s + 12, NULL, 10);
+        return max_nodes > 0 ? 0 : -1;
+    } else if (strncmp(s, "--max-rss=", 10) == 0) {
+        max_rss = (size_t) atol(s + 10) << 20;
+        return max_rss > 0 ? 0 : -1;
+    } else if (strncmp(s, "--beam-width=", 13) == 0) {
+        beam_width = atoi(s + 13);
+        return beam_width > 0 ? 0 : -1;
+    } else if (strcmp(s, "--external") == 0) {
+        external_dir = ".";
+        return 0;
+    } else if (strncmp(s, "--external=", 11) == 0) {
+        external_dir = s + 11;
+        return *external_dir != '\0' ? 0 : -1;
+    } else if (strcmp(s, "--memory-bounded") == 0) {
+        memory_bounded = 1;
+        return 0;
+    } else if (strcmp(s, "--pdb") == 0) {
+        pdb_file = "freecell.pdb";
+        return 0;
+    } else if (strncmp(s, "--pdb=", 6) == 0) {
+        pdb_file = s + 6;
+        return *pdb_file != '\0' ? 0 : -1;
+    } else if (strcmp(s, "--anytime") == 0) {
+        anytime = DEFAULT_ANYTIME_WEIGHT;
+        return 0;
+    } else if (strncmp(s, "--anytime=", 10) == 0) {
+        anytime = atoi(s + 10);
+        return anytime > 0 ? 0 : -1;
+    }
+
+    return -1;
+}
+
+// Returns the name of a move, as written in solution files.
+// Inputs:
+//      int move: A move
+char *move_name(int move)
+{
+    if (move == foundation) {
+        return "foundation";
+    } else if (move == newstack) {
+        return "newstack";
+    } else if (move == stack) {
+        return "stack";
+    }
+
+    return "freecell";
+}
+
+// Function that prints a card, e.g. H3 for the three of hearts.
+// Inputs:
+//      FILE *fout: Stream to print to
+//      unsigned char c: Card to print
+void print_card(FILE *fout, unsigned char c)
+{
+    if (card_suit(c) == HEARTS) {
+        fprintf(fout, "H");
+    } else if (card_suit(c) == SPADES) {
+        fprintf(fout, "S");
+    } else if (card_suit(c) == DIAMONDS) {
+        fprintf(fout, "D");
+    } else {
+        fprintf(fout, "C");
+    }
+    fprintf(fout, "%d", card_value(c));
+}
+
 // Function that displays the board on the screen.
 // Inputs:
-//      struct card board[16][52]: Board to display
-//      int tops[16]: Board tops array
-void display_board(struct card board[16][52], int tops[16])
+//      struct board *board: Board to display
+void display_board(struct board *board)
 {
-    for (int i = 0; i < 16; i++) {
-        printf("top: %d\n", tops[i]);
-        for (int j = 0; j < 52; j++) {
-            if (board[i][j].value == -1) {
-                continue;
-            }
-            
-            if (board[i][j].suit == 0) {
-                printf("H");
-            } else if (board[i][j].suit == 1) {
-                printf("S");
-            } else if (board[i][j].suit == 2) {
-                printf("D");
-            } else if (board[i][j].suit == 3) {
-                printf("C");
-            }
-            
-            printf("%d ", board[i][j].value);
+    int pos = 0;
+    for (int i = 0; i < 8; i++) {
+        printf("stack %d:", i);
+        for (int j = 0; j < board->len[i]; j++, pos++) {
+            printf(" ");
+            print_card(stdout, board->cards[pos]);
         }
-        
         printf("\n");
     }
+
+    printf("freecells:");
+    for (int i = 0; i < 4; i++) {
+        if (board->freecells[i] != NO_CARD) {
+            printf(" ");
+            print_card(stdout, board->freecells[i]);
+        }
+    }
+    printf("\nfoundations: H%d S%d D%d C%d\n", board->foundations[HEARTS], board->foundations[SPADES],
+           board->foundations[DIAMONDS], board->foundations[CLUBS]);
+}
+
+// Returns the wall-clock time, in seconds from an arbitrary origin.
+double wall_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the wall-clock time when statistics are on, 0 otherwise, so that timing
+// costs nothing without the --stats option.
+double stats_clock()
+{
+    return stats_format ? wall_clock() : 0;
+}
+
+// Updates the frontier length statistics.
+// Inputs:
+//      long change: Nodes added to (or removed from, if negative) the frontier
+void count_frontier(long change)
+{
+    stats.frontier += change;
+    if (stats.frontier > stats.max_frontier) {
+        stats.max_frontier = stats.frontier;
+    }
+}
+
+// Adds the statistics of a worker to those of the current thread. Frontier
+// lengths are summed too, since the workers have a frontier each.
+// Inputs:
+//      struct search_stats *worker_stats: The statistics of the worker
+void add_stats(struct search_stats *worker_stats)
+{
+    stats.expanded += worker_stats->expanded;
+    stats.generated += worker_stats->generated;
+    stats.duplicates += worker_stats->duplicates;
+    stats.forgotten += worker_stats->forgotten;
+    stats.dead_ends += worker_stats->dead_ends;
+    stats.redundant += worker_stats->redundant;
+    stats.frontier += worker_stats->frontier;
+    stats.max_frontier += worker_stats->max_frontier;
+    stats.bytes_allocated += worker_stats->bytes_allocated;
+    stats.allocations += worker_stats->allocations;
+    stats.move_time += worker_stats->move_time;
+    stats.visited_time += worker_stats->visited_time;
+    stats.evaluation_time += worker_stats->evaluation_time;
+    stats.insertion_time += worker_stats->insertion_time;
+}
+
+// Checks whether the search structures of the current thread would go over the
+// memory limit with some more bytes.
+// Inputs:
+//      size_t extra: Bytes about to be allocated
+// Output:
+//      1 --> Over the limit
+//      0 --> Within the limit (or no limit)
+int over_memory_limit(size_t extra)
+{
+    if (memory_limit == 0) {
+        return 0;
+    }
+    size_t used = (tree_pool.slabs + frontier_pool.slabs + board_pool.slabs) * SLAB_SIZE
+                  + visited.size * sizeof(struct hash_slot)
+                  + frontier_heap.capacity * sizeof(struct tree_node*);
+
+    return used + extra > memory_limit;
+}
+
+// Returns the current resident set size of the process, as reported by Linux.
+// Output:
+//      size_t --> RSS in bytes (0 if unknown)
+size_t current_rss()
+{
+    FILE *fin = fopen("/proc/self/statm", "r");
+    unsigned long pages = 0;
+    if (fin == NULL) {
+        return 0;
+    }
+    if (fscanf(fin, "%*s %lu", &pages) != 1) {
+        pages = 0;
+    }
+    fclose(fin);
+
+    return pages * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// Checks the budgets of the current search: its deadline, the boards it expanded
+// (its share of them in the parallel search) and the RSS of the process. The search
+// loops call it when stats.expanded reaches next_poll, and stop when it returns 1.
+// Output:
+//      1 --> A budget is exceeded (stop_reason tells which)
+//      0 --> The search may go on
+int budget_exceeded()
+{
+    if (wall_clock() > search_deadline) {
+        stop_reason = STOP_TIME;
+    } else if (max_nodes > 0 && stats.expanded >= max_nodes / budget_share) {
+        stop_reason = STOP_NODES;
+    } else if (max_rss > 0 && current_rss() > max_rss) {
+        stop_reason = STOP_RSS;
+    }
+
+    next_poll = stats.expanded + POLL_INTERVAL;
+    if (max_nodes > 0 && next_poll > max_nodes / budget_share) {
+        next_poll = max_nodes / budget_share;
+    }
+
+    return stop_reason != STOP_NONE;
+}
+
+// This function allocates an object from a pool.
+// Inputs:
+//      struct pool *pool: The pool of the object's type
+// Output:
+//      NULL --> Memory problem when allocating a new slab
+//      void* --> The new object
+void *pool_alloc(struct pool *pool)
+{
+    void *object;
+    stats.allocations++;
+    if (pool->free_list != NULL) {
+        object = pool->free_list;
+        pool->free_list = *(void**)object;
+        pool->spare--;
+        return object;
+    }
+
+    if (pool->used + pool->object_size > SLAB_SIZE) {
+        char *slab = over_memory_limit(SLAB_SIZE) ? NULL : (char*) malloc(SLAB_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        *(char**)slab = pool->slab;
+        pool->slab = slab;
+        pool->used = SLAB_HEADER;
+        pool->slabs++;
+        stats.bytes_allocated += SLAB_SIZE;
+    }
+    object = pool->slab + pool->used;
+    pool->used += pool->object_size;
+
+    return object;
+}
+
+// This function gives an object back to its pool, for later reuse.
+// Inputs:
+//      struct pool *pool: The pool the object was allocated from
+//      void *object: The object
+void pool_free(struct pool *pool, void *object)
+{
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->spare++;
+}
+
+// This function releases all the slabs of a pool, i.e. all its objects.
+// Inputs:
+//      struct pool *pool: A pool
+void pool_release(struct pool *pool)
+{
+    while (pool->slab != NULL) {
+        char *previous = *(char**)pool->slab;
+        free(pool->slab);
+        pool->slab = previous;
+    }
+    pool->free_list = NULL;
+    pool->used = SLAB_SIZE;
+    pool->slabs = 0;
+    pool->spare = 0;
 }
 
 // This function adds a pointer to a new leaf search-tree node at the front of the frontier.
@@ -148,11 +760,11 @@ int add_frontier_front(struct tree_node *node)
 {
     #ifdef DEBUG
         printf("Adding to the front:\n");
-        display_board(node->board, node->tops);
+        display_board(node->board);
     #endif
 
     // Creating the new frontier node.
-    struct frontier_node *new_frontier_node = (struct frontier_node*) malloc(sizeof(struct frontier_node));
+    struct frontier_node *new_frontier_node = (struct frontier_node*) pool_alloc(&frontier_pool);
     if (new_frontier_node == NULL) {
         return -1;
     }
@@ -160,6 +772,7 @@ int add_frontier_front(struct tree_node *node)
     new_frontier_node->n = node;
     new_frontier_node->previous = NULL;
     new_frontier_node->next = frontier_head;
+    count_frontier(1);
 
     if (frontier_head == NULL) {
         frontier_head = new_frontier_node;
@@ -184,11 +797,11 @@ int add_frontier_back(struct tree_node *node)
 {
     #ifdef DEBUG
         printf("Adding to the back...\n");
-        display_board(node->board, node->tops);
+        display_board(node->board);
     #endif
 
     // Creating the new frontier node.
-    struct frontier_node *new_frontier_node = (struct frontier_node*) malloc(sizeof(struct frontier_node));
+    struct frontier_node *new_frontier_node = (struct frontier_node*) pool_alloc(&frontier_pool);
     if (new_frontier_node == NULL) {
         return -1;
     }
@@ -196,6 +809,7 @@ int add_frontier_back(struct tree_node *node)
     new_frontier_node->n = node;
     new_frontier_node->next = NULL;
     new_frontier_node->previous = frontier_tail;
+    count_frontier(1);
 
     if (frontier_tail == NULL) {
         frontier_head = new_frontier_node;
@@ -209,9 +823,67 @@ int add_frontier_back(struct tree_node *node)
     return 0;
 }
 
+// Checks whether a node must leave the frontier heap before another one.
+// Inputs:
+//      struct tree_node *a: A search-tree node
+//      struct tree_node *b: Another search-tree node
+// Output:
+//      1 --> Node a comes first
+//      0 --> Node b comes first
+int heap_before(struct tree_node *a, struct tree_node *b)
+{
+    if (a->f != b->f) {
+        return a->f > b->f;
+    }
+    if (a->h != b->h) {
+        return a->h > b->h;
+    }
+
+    return a->seq > b->seq;
+}
+
+// Places a node at a position of the frontier heap.
+// Inputs:
+//      struct tree_node *node: A search-tree node
+//      int i: Heap position
+void heap_place(struct tree_node *node, int i)
+{
+    frontier_heap.nodes[i] = node;
+    node->heap_index = i;
+}
+
+// Moves a node of the frontier heap up or down until the heap order is restored.
+// Inputs:
+//      struct tree_node *node: A search-tree node in the heap
+void heap_update(struct tree_node *node)
+{
+    int i = node->heap_index;
+    int child;
+
+    // Sift up.
+    while (i > 0 && heap_before(node, frontier_heap.nodes[(i - 1) / 2])) {
+        heap_place(frontier_heap.nodes[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+
+    // Sift down.
+    while ((child = 2 * i + 1) < frontier_heap.count) {
+        if (child + 1 < frontier_heap.count && heap_before(frontier_heap.nodes[child + 1], frontier_heap.nodes[child])) {
+            child++;
+        }
+        if (!heap_before(frontier_heap.nodes[child], node)) {
+            break;
+        }
+        heap_place(frontier_heap.nodes[child], i);
+        i = child;
+    }
+
+    heap_place(node, i);
+}
+
 // This function adds a pointer to a new leaf search-tree node within the frontier.
-// The frontier is always kept in decreasing order with the f values of the corresponding
-// search-tree nodes. The new frontier node is inserted in order.
+// The frontier is a heap ordered by decreasing f values of the corresponding
+// search-tree nodes (see heap_before), so the insertion costs O(log n).
 // This function is called by the heuristic search algorithm.
 // Inputs:
 //      struct tree_node *node: A (leaf) search-tree node
@@ -222,690 +894,3268 @@ int add_frontier_in_order(struct tree_node *node)
 {
     #ifdef DEBUG
         printf("Adding in order (f=%d)...\n", node->f);
-        display_board(node->board, node->tops);
+        display_board(node->board);
     #endif
 
-    // Creating the new frontier node.
-    struct frontier_node *new_frontier_node = (struct frontier_node*) malloc(sizeof(struct frontier_node));
-    if (new_frontier_node == NULL) {
-        return -1;
+    if (frontier_heap.count == frontier_heap.capacity) {
+        int capacity = frontier_heap.capacity > 0 ? 2 * frontier_heap.capacity : 1024;
+        if (over_memory_limit((capacity - frontier_heap.capacity) * sizeof(struct tree_node*))) {
+            return -1;
+        }
+        struct tree_node **nodes = (struct tree_node**) realloc(frontier_heap.nodes, capacity * sizeof(struct tree_node*));
+        if (nodes == NULL) {
+            return -1;
+        }
+        stats.bytes_allocated += (capacity - frontier_heap.capacity) * sizeof(struct tree_node*);
+        frontier_heap.nodes = nodes;
+        frontier_heap.capacity = capacity;
     }
 
-    new_frontier_node->n = node;
-    new_frontier_node->previous = NULL;
-    new_frontier_node->next = NULL;
+    node->seq = frontier_heap.seq++;
+    heap_place(node, frontier_heap.count++);
+    heap_update(node);
+    count_frontier(1);
+
+    return 0;
+}
+
+// This function removes the first node of the frontier.
+// Inputs:
+//      int method: Execution algorithm.
+// Output:
+//      NULL --> The frontier is empty
+//      struct tree_node* --> The removed search-tree node
+struct tree_node *pop_frontier(int method)
+{
+    struct tree_node *node;
+
+    if (method == best || method == astar) {
+        if (frontier_heap.count == 0) {
+            return NULL;
+        }
+        node = frontier_heap.nodes[0];
+        node->heap_index = -1;
+        frontier_heap.count--;
+        count_frontier(-1);
+        if (frontier_heap.count > 0) {
+            heap_place(frontier_heap.nodes[frontier_heap.count], 0);
+            heap_update(frontier_heap.nodes[0]);
+        }
+        return node;
+    }
 
     if (frontier_head == NULL) {
-        frontier_head = new_frontier_node;
-        frontier_tail = new_frontier_node;
-        return 0;
+        return NULL;
     }
-    
-    struct frontier_node *pt = frontier_head;
-    // Search in the frontier for the first node that corresponds to either a smaller f value
-    // or to an equal f value but smaller h value.
-    // Note that for the best first search algorithm, f and h values coincide.
-    while (pt != NULL && (pt->n->f > node->f || (pt->n->f == node->f && pt->n->h > node->h))) {
-        pt = pt->next;
-    }
-
-    if (pt == NULL) {
-        // New_frontier_node is inserted at the back of the frontier.
-        frontier_tail->next = new_frontier_node;
-        new_frontier_node->previous = frontier_tail;
-        frontier_tail = new_frontier_node;
-        return 0;
+    struct frontier_node *first = frontier_head;
+    node = first->n;
+    count_frontier(-1);
+    frontier_head = first->next;
+    if (frontier_head != NULL) {
+        frontier_head->previous = NULL;
+    } else {
+        frontier_tail = NULL;
     }
+    pool_free(&frontier_pool, first);
 
-    // new_frontier_node is inserted before pt .
-    if (pt->previous != NULL) {
-        pt->previous->next = new_frontier_node;
-        new_frontier_node->next = pt;
-        new_frontier_node->previous = pt->previous;
-        pt->previous = new_frontier_node;
-        return 0;
-    }
-    
-    // In this case, new_frontier_node becomes the first node of the frontier.
-    new_frontier_node->next = pt;
-    pt->previous = new_frontier_node;
-    frontier_head = new_frontier_node;
+    return node;
+}
 
-    return 0;
+// Fills the Zobrist key tables with pseudo-random numbers (splitmix64 with a fixed seed,
+// so hashes are the same from run to run).
+void init_zobrist()
+{
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    unsigned long long z;
+    for (int c = 0; c < MAX_CARDS; c++) {
+        for (int i = 0; i <= MAX_CARDS + 1; i++) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            z = z ^ (z >> 31);
+            if (i <= MAX_CARDS) {
+                zobrist_stack[c][i] = z;
+            } else {
+                zobrist_freecell[c] = z;
+            }
+        }
+    }
 }
 
 // This function generates a new puzzle board.
 // Inputs:
-//      struct card[16][52] board: The board to initialize
-//      int[16] tops: Board tops array
-void generate_board(struct card board[16][52], int tops[16])
+//      struct board *board: The board to initialize
+void generate_board(struct board *board)
 {
-    for (int i = 0; i < 16; i++) {
-        for (int j = 0; j < 52; j++) {
-            board[i][j].suit = -1;
-            board[i][j].value = -1;
-        }
-        tops[i] = -1;
+    memset(board->cards, NO_CARD, sizeof(board->cards));
+    memset(board->len, 0, sizeof(board->len));
+    memset(board->freecells, NO_CARD, sizeof(board->freecells));
+    memset(board->foundations, 0, sizeof(board->foundations));
+    board->hash = 0;
+}
+
+// Returns the position in the cards table where a stack begins.
+// Inputs:
+//      struct board *board: A board
+//      int i: Stack index (0-7)
+// Output:
+//      int --> Position of the bottom card of the stack
+int stack_start(struct board *board, int i)
+{
+    int pos = 0;
+    for (int j = 0; j < i; j++) {
+        pos += board->len[j];
     }
+
+    return pos;
 }
 
-// This function reads a file containing a puzzle.
+// Returns the total number of cards placed on the stacks.
 // Inputs:
-//      char *filename: The name of the file containing a freecell solitaire puzzle
-//      struct card[16][52] puzzle: The puzzle
-//      int[16] tops: Board tops array
+//      struct board *board: A board
 // Output:
-//      0 --> Successful read.
-//      1 --> Unsuccessful read
-int read_puzzle(char *filename, struct card puzzle[16][52], int tops[16])
+//      int --> Number of cards on the stacks
+int stacked_cards(struct board *board)
 {
-    FILE *fin;
-    int i, j;
-    char c;
-    struct card filecard;
+    return stack_start(board, 8);
+}
 
-    fin = fopen(filename, "r");
-    if (fin == NULL) {
-        printf("Cannot open file %s. Program terminates.\n", filename);
-        return -1;
+// Returns the card that the k top cards of a stack lie on, or FROM_FREECELL for a
+// freecell (see move_record).
+// Inputs:
+//      struct board *board: A board
+//      int from: Stack (0-7) or freecell (8-11) index
+//      int k: Number of cards moved
+// Output:
+//      NO_CARD --> The cards are the whole stack
+//      unsigned char --> The card below them, or FROM_FREECELL
+unsigned char card_below(struct board *board, int from, int k)
+{
+    if (from >= 8) {
+        return FROM_FREECELL;
+    }
+    if (board->len[from] <= k) {
+        return NO_CARD;
     }
 
-    // Extracting N value
-    fscanf(fin, "%d ", &N);
+    return board->cards[stack_start(board, from) + board->len[from] - k - 1];
+}
 
-    // Initializing the puzzle board.
-    printf("Building puzzle with N: %d\n", N);
-    generate_board(puzzle, tops);
+// Returns the top card of a stack or the card of a freecell.
+// Inputs:
+//      struct board *board: A board
+//      int i: Stack (0-7) or freecell (8-11) index
+// Output:
+//      NO_CARD --> The stack or freecell is empty
+//      unsigned char --> The top card
+unsigned char top_card(struct board *board, int i)
+{
+    if (i >= 8) {
+        return board->freecells[i - 8];
+    }
+    if (board->len[i] == 0) {
+        return NO_CARD;
+    }
+
+    return board->cards[stack_start(board, i) + board->len[i] - 1];
+}
+
+// Removes the top card of a stack or the card of a freecell.
+// Inputs:
+//      struct board *board: A board
+//      int from: Stack (0-7) or freecell (8-11) index
+// Output:
+//      unsigned char --> The removed card
+unsigned char pop_card(struct board *board, int from)
+{
+    unsigned char c;
+    if (from >= 8) {
+        c = board->freecells[from - 8];
+        board->freecells[from - 8] = NO_CARD;
+        board->hash ^= zobrist_freecell[c];
+        return c;
+    }
+
+    int total = stacked_cards(board);
+    int pos = stack_start(board, from) + board->len[from] - 1;
+    c = board->cards[pos];
+    board->hash ^= zobrist_stack[c][board->len[from] > 1 ? board->cards[pos - 1] : MAX_CARDS];
+    memmove(&board->cards[pos], &board->cards[pos + 1], total - pos - 1);
+    board->cards[total - 1] = NO_CARD;
+    board->len[from]--;
+
+    return c;
+}
+
+// Places a card on top of a stack.
+// Inputs:
+//      struct board *board: A board
+//      int to: Stack index (0-7)
+//      unsigned char c: The card to place
+void push_card(struct board *board, int to, unsigned char c)
+{
+    int total = stacked_cards(board);
+    int pos = stack_start(board, to) + board->len[to];
+    board->hash ^= zobrist_stack[c][board->len[to] > 0 ? board->cards[pos - 1] : MAX_CARDS];
+    memmove(&board->cards[pos + 1], &board->cards[pos], total - pos);
+    board->cards[pos] = c;
+    board->len[to]++;
+}
+
+// Brings a board to its canonical form: occupied freecells first and in increasing
+// card order, stacks in increasing order of their bottom card and empty stacks last.
+// Boards differing only in the order of their freecells or stacks are strategically
+// identical and become byte-equal. The hash does not change, as it is order independent.
+// Inputs:
+//      struct board *board: A board
+void canonicalize_board(struct board *board)
+{
+    int i, j, pos;
+    unsigned char c;
+
+    // Sorting freecells (NO_CARD is greater than any card).
+    for (i = 1; i < 4; i++) {
+        c = board->freecells[i];
+        for (j = i; j > 0 && board->freecells[j - 1] > c; j--) {
+            board->freecells[j] = board->freecells[j - 1];
+        }
+        board->freecells[j] = c;
+    }
+
+    // Only a move emptying a stack or filling an empty one can break the stack order.
+    unsigned char bottom[8];
+    int start[8], order[8], sorted = 1;
+    for (i = 0, pos = 0; i < 8; i++) {
+        start[i] = pos;
+        bottom[i] = board->len[i] > 0 ? board->cards[pos] : NO_CARD;
+        pos += board->len[i];
+        if (i > 0 && bottom[i] < bottom[i - 1]) {
+            sorted = 0;
+        }
+    }
+    if (sorted) {
+        return;
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (j = i; j > 0 && bottom[order[j - 1]] > bottom[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    struct board sorted_board = *board;
+    for (i = 0, pos = 0; i < 8; i++) {
+        memcpy(&sorted_board.cards[pos], &board->cards[start[order[i]]], board->len[order[i]]);
+        sorted_board.len[i] = board->len[order[i]];
+        pos += board->len[order[i]];
+    }
+    *board = sorted_board;
+}
+
+// This function reads the cards of a stack from a line of a puzzle file.
+// Inputs:
+//      struct board *puzzle: The puzzle
+//      int i: The stack
+//      char *buffer: The line, e.g. "H1 C2 S5 S0"
+void parse_stack(struct board *puzzle, int i, char *buffer)
+{
+    for (int jj = 0; buffer[jj] != '\0'; jj++) {
+        if ((buffer[jj] == ' ') || buffer[jj] == '\n' || buffer[jj] == '\r') {
+            continue;
+        }
+        char suit = buffer[jj];
+        int s = HEARTS;
+        if (suit == 'S') {
+            s = SPADES;
+        } else if (suit == 'D') {
+            s = DIAMONDS;
+        } else if (suit == 'C') {
+            s = CLUBS;
+        }
+        jj++;
+        if (buffer[jj] == '\0') {
+            break;
+        }
+        push_card(puzzle, i, make_card(s, buffer[jj] - '0'));
+    }
+}
+
+// This function reads a file containing a puzzle.
+// Inputs:
+//      char *filename: The name of the file containing a freecell solitaire puzzle
+//      struct board *puzzle: The puzzle
+// Output:
+//      0 --> Successful read.
+//      1 --> Unsuccessful read
+int read_puzzle(char *filename, struct board *puzzle)
+{
+    FILE *fin;
+    int i;
+
+    fin = fopen(filename, "r");
+    if (fin == NULL) {
+        printf("Cannot open file %s. Program terminates.\n", filename);
+        return -1;
+    }
+
+    // Extracting N value
+    fscanf(fin, "%d ", &N);
+
+    // Initializing the puzzle board.
+    printf("Building puzzle with N: %d\n", N);
+    generate_board(puzzle);
 
     // Reading lines
     char *buffer = NULL;
     size_t bufsize = 0;
-    size_t characters;
     i = 0;
-    while ((characters = getline(&buffer, &bufsize, fin)) != -1) {
-        j = 0;
-        for (int jj = 0; jj < (int)characters; jj++) {
-            if ((buffer[jj] == ' ') || buffer[jj] == '\n') {
-                continue;
-            }
-            char suit = buffer[jj];
-            puzzle[i][j].suit = 0;
-            if (suit == 'S') {
-                puzzle[i][j].suit = 1;
-            } else if (suit == 'D') {
-                puzzle[i][j].suit = 2;
-            } else if (suit == 'C') {
-                puzzle[i][j].suit = 3;
-            }
-            jj++;
-            puzzle[i][j].value = buffer[jj] - '0';
-            j++;
-            tops[i]++;
-        }
+    while (getline(&buffer, &bufsize, fin) != -1 && i < 8) {
+        parse_stack(puzzle, i, buffer);
         i++;
     }
 
+    free(buffer);
     fclose(fin);
 
     return 0;
 }
 
-// This function checks whether a board of a node is a solution board.
+// This function checks whether a board is a solution board.
 // Inputs:
-//      struct tree_node *current: A node
+//      struct board *board: A board
 // Outputs:
 //      1 --> The puzzle is a solution puzzle
 //      0 --> The puzzle is NOT a solution puzzle
-int is_solution(struct tree_node *current)
+int is_solution(struct board *board)
 {
-    if ((current->tops[12] == (N - 1))
-        && (current->tops[13] == (N - 1))
-        && (current->tops[14] == (N - 1))
-        && (current->tops[15] == (N - 1))) {
+    if ((board->foundations[HEARTS] == N)
+        && (board->foundations[SPADES] == N)
+        && (board->foundations[DIAMONDS] == N)
+        && (board->foundations[CLUBS] == N)) {
         return 1;
     }
     return 0;
 }
 
-// This function moves a card to the foundation with the same suit.
+// This function checks whether a board can no longer be solved. That can only be
+// proven here with no free freecell and no empty stack: a card then leaves its
+// place only for the foundation or for another stack. Playing every card home that
+// can go there, in the order of its suit, uncovers all the cards that can ever be
+// reached without a stack move. If that frees no freecell and no stack, and none
+// of those cards fits on another, no move but a foundation one is ever possible,
+// and those run out before the end.
 // Inputs:
-//      struct tree_node *child: A child node
-//      int from: Stack moved from
-//      int to: Stack going to
-void move_to_foundation(struct tree_node *child, int from, int to)
+//      struct board *board: A board
+// Outputs:
+//      1 --> The puzzle cannot be solved
+//      0 --> The puzzle may be solved
+int dead_end(struct board *board)
 {
-    child->tops[to]++;
-    child->board[to][child->tops[to]].suit = child->board[from][child->tops[from]].suit;
-    child->board[to][child->tops[to]].value = child->board[from][child->tops[from]].value;
-    child->board[from][child->tops[from]].suit = -1;
-    child->board[from][child->tops[from]].value = -1;
-    child->tops[from]--;
+    unsigned char foundations[4];
+    unsigned char exposed[MAX_CARDS + 4];
+    int place[MAX_CARDS + 4];   // Stack (0-7) or freecell (8) of each exposed card.
+    int start[8], home[8];      // Bottom of each stack, and cards of it gone home.
+    int freecell_home[4] = {0};
+    int i, j, count, changed;
+
+    for (i = 0; i < 4; i++) {
+        if (board->freecells[i] == NO_CARD) {
+            return 0;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (board->len[i] == 0) {
+            return 0;
+        }
+        start[i] = i == 0 ? 0 : start[i - 1] + board->len[i - 1];
+        home[i] = 0;
+    }
+    // Most full boards still have a move between stacks: no need to look further.
+    unsigned long long tops = 0;
+    for (i = 0; i < 8; i++) {
+        tops |= card_bit(board->cards[start[i] + board->len[i] - 1]);
+    }
+    for (i = 0; i < 12; i++) {
+        unsigned char c = i < 8 ? board->cards[start[i] + board->len[i] - 1] : board->freecells[i - 8];
+        if (card_targets[c] & tops) {
+            return 0;
+        }
+    }
+    memcpy(foundations, board->foundations, sizeof(foundations));
+
+    do {
+        changed = 0;
+        for (i = 0; i < 12; i++) {
+            unsigned char c;
+            if (i < 8) {
+                c = home[i] < board->len[i] ? board->cards[start[i] + board->len[i] - 1 - home[i]] : NO_CARD;
+            } else {
+                c = freecell_home[i - 8] ? NO_CARD : board->freecells[i - 8];
+            }
+            if (c != NO_CARD && card_value(c) == foundations[card_suit(c)]) {
+                foundations[card_suit(c)]++;
+                if (i < 8) {
+                    home[i]++;
+                } else {
+                    freecell_home[i - 8] = 1;
+                }
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    // A free freecell or an empty stack takes any card (a solution empties them all).
+    for (i = 0; i < 4; i++) {
+        if (freecell_home[i]) {
+            return 0;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (home[i] == board->len[i]) {
+            return 0;
+        }
+    }
+
+    // The cards that can be uncovered: the freecell cards, and the top card of each
+    // stack together with those above it that went home.
+    count = 0;
+    for (i = 0; i < 4; i++) {
+        exposed[count] = board->freecells[i];
+        place[count++] = 8;
+    }
+    for (i = 0; i < 8; i++) {
+        for (j = board->len[i] - 1 - home[i]; j < board->len[i]; j++) {
+            exposed[count] = board->cards[start[i] + j];
+            place[count++] = i;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        for (j = 4; j < count; j++) {
+            if (place[i] != place[j] && card_fits(exposed[i], exposed[j])) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
 }
 
-// This function moves an ACE to a free foundation.
+// This function moves a card to the foundation with the same suit.
+// Aces start the (empty) foundation of their suit.
 // Inputs:
-//      struct tree_node *child: A child node
+//      struct board *board: A child board
 //      int from: Stack moved from
-void move_to_empty_foundation(struct tree_node *child, int from)
+void move_to_foundation(struct board *board, int from)
 {
-    for (int i = 12; i < 16; i++) {
-        if (child->tops[i] != -1) {
-            continue;
-        }
-        child->tops[i]++;
-        child->board[i][child->tops[i]].suit = child->board[from][child->tops[from]].suit;
-        child->board[i][child->tops[i]].value = child->board[from][child->tops[from]].value;
-        child->board[from][child->tops[from]].suit = -1;
-        child->board[from][child->tops[from]].value = -1;
-        child->tops[from]--;
-        break;
-    }
+    unsigned char c = pop_card(board, from);
+    board->foundations[card_suit(c)]++;
 }
 
 // This function moves a card to free stack.
 // Inputs:
-//      struct tree_node *child: A child node
+//      struct board *board: A child board
 //      int from: Stack moved from
-void move_to_new_stack(struct tree_node *child, int from)
+void move_to_new_stack(struct board *board, int from)
 {
+    unsigned char c = pop_card(board, from);
     for (int i = 0; i < 8; i++) {
-        if (child->tops[i] != -1) {
+        if (board->len[i] != 0) {
             continue;
         }
-        child->tops[i]++;
-        child->board[i][child->tops[i]].suit = child->board[from][child->tops[from]].suit;
-        child->board[i][child->tops[i]].value = child->board[from][child->tops[from]].value;
+        push_card(board, i, c);
         break;
     }
-    child->board[from][child->tops[from]].suit = -1;
-    child->board[from][child->tops[from]].value = -1;
-    child->tops[from]--;
 }
 
 // This function moves a card to another stack.
 // Inputs:
-//      struct tree_node *child: A child node
+//      struct board *board: A child board
 //      int from: Stack moved from
 //      int to: Stack going to
-void move_to_stack(struct tree_node *child, int from, int to)
+void move_to_stack(struct board *board, int from, int to)
 {
-    child->tops[to]++;
-    child->board[to][child->tops[to]].suit = child->board[from][child->tops[from]].suit;
-    child->board[to][child->tops[to]].value = child->board[from][child->tops[from]].value;
-    child->board[from][child->tops[from]].suit = -1;
-    child->board[from][child->tops[from]].value = -1;
-    child->tops[from]--;
+    push_card(board, to, pop_card(board, from));
 }
 
 // This function moves a card to a freecell.
 // Inputs:
-//      struct tree_node *child: A child node
+//      struct board *board: A child board
 //      int from: Stack moved from
-void move_to_a_freecell(struct tree_node *child, int from)
+void move_to_a_freecell(struct board *board, int from)
 {
-    if (child->tops[8] == -1) {
-        child->tops[8]++;
-        child->board[8][0].suit = child->board[from][child->tops[from]].suit;
-        child->board[8][0].value = child->board[from][child->tops[from]].value;
-    } else if (child->tops[9] == -1) {
-        child->tops[9]++;
-        child->board[9][0].suit = child->board[from][child->tops[from]].suit;
-        child->board[9][0].value = child->board[from][child->tops[from]].value;
-    } else if (child->tops[10] == -1) {
-        child->tops[10]++;
-        child->board[10][0].suit = child->board[from][child->tops[from]].suit;
-        child->board[10][0].value = child->board[from][child->tops[from]].value;
-    } else if (child->tops[11] == -1) {
-        child->tops[11]++;
-        child->board[11][0].suit = child->board[from][child->tops[from]].suit;
-        child->board[11][0].value = child->board[from][child->tops[from]].value;
+    unsigned char c = pop_card(board, from);
+    for (int i = 0; i < 4; i++) {
+        if (board->freecells[i] == NO_CARD) {
+            board->freecells[i] = c;
+            board->hash ^= zobrist_freecell[c];
+            break;
+        }
     }
-
-    child->board[from][child->tops[from]].suit = -1;
-    child->board[from][child->tops[from]].value = -1;
-    child->tops[from]--;
 }
 
-// This function checks whether two boards are qual.
+// Locates a card on top of a stack or in a freecell.
 // Inputs:
-//      struct tree_node *n: A tree node (child)
-//      struct tree_node *p: Another tree node (parent)
+//      struct board *board: A board
+//      unsigned char c: The card
 // Output:
-//      1 --> Nodes are equal
-//      0 --> Nodes are not equal
-int equal_nodes(struct tree_node *n, struct tree_node *p)
+//      -1 --> The card is not movable
+//      int --> Stack (0-7) or freecell (8-11) index
+int find_card(struct board *board, unsigned char c)
 {
     for (int i = 0; i < 12; i++) {
-        for (int j = 0; j < 52; j++) {
-            if ((n->board[i][j].suit != p->board[i][j].suit) || (n->board[i][j].value != p->board[i][j].value)) {
-                return 0;
-            }
+        if (top_card(board, i) == c) {
+            return i;
         }
     }
 
-    return 1;
+    return -1;
 }
 
-// This function checks whether a node in the search tree
-// holds exactly the same board with at least one of its
-// predecessors. This function is used when creating the childs
-// of an existing search tree node, in order to check for each one of the childs
-// whether this appears in the path from the root to its parent.
-// This is a moderate way to detect loops in the search.
+// Locates a card in the stacks, at any depth.
 // Inputs:
-//      struct tree_node *new_node: A search tree node (usually a new one)
+//      struct board *board: A board
+//      unsigned char c: The card
 // Output:
-//      1 --> No coincidence with any predecessor
-//      0 --> Loop detection
-int check_with_parents(struct tree_node *new_node)
+//      -1 --> The card is not stacked
+//      int --> Stack index
+int find_stacked_card(struct board *board, unsigned char c)
 {
-    struct tree_node *parent = new_node->parent;
-    while (parent != NULL) {
-        if (equal_nodes(new_node, parent)) {
-            return 0;
+    int k = 0;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < board->len[i]; j++, k++) {
+            if (board->cards[k] == c) {
+                return i;
+            }
         }
-        parent = parent->parent;
     }
-    return 1;
+
+    return -1;
 }
 
-// Computes the sum of the freecells of the board.
-// This function moves a card to a freecell.
+// Returns the number of cards on top of a stack that form a run: each one lies on a
+// card of the other colour, one higher.
 // Inputs:
-//      struct tree_node *node: A tree node
+//      struct board *board: A board
+//      int i: Stack index
 // Output:
-//      int --> Node score
-int freecells_count(struct tree_node *node)
+//      int --> Length of the run (0 for an empty stack)
+int run_length(struct board *board, int i)
 {
-    int score = 0;
-    if (node->tops[8] == -1) {
-        score++;
-    }
-    if (node->tops[9] == -1) {
-        score++;
-    }
-    if (node->tops[10] == -1) {
-        score++;
-    }
-    if (node->tops[11] == -1) {
-        score++;
+    int top = stack_start(board, i) + board->len[i] - 1;
+    int k = board->len[i] > 0 ? 1 : 0;
+    while (k < board->len[i] && card_fits(board->cards[top - k + 1], board->cards[top - k])) {
+        k++;
     }
 
-    return score;
+    return k;
 }
 
-// Computes the sum of the cards at foundations of the board.
+// Returns the number of cards a sequence move can take to a stack, one at a time:
+// (free freecells + 1) * 2^(empty stacks other than the target).
 // Inputs:
-//      struct tree_node *node: A tree node
+//      struct board *board: A board
+//      int to: The target stack
 // Output:
-//      int --> Node score
-int num_cards_at_foundations(struct tree_node *node)
+//      int --> Number of cards
+int sequence_capacity(struct board *board, int to)
 {
-    int score = 0;
-    if (node->tops[12] != -1) {
-        score += node->tops[12];
-        score++;
-    }
-    if (node->tops[13] != -1) {
-        score += node->tops[13];
-        score++;
-    }
-    if (node->tops[14] != -1) {
-        score += node->tops[14];
-        score++;
+    int cells = 0, empties = 0;
+    for (int i = 0; i < 4; i++) {
+        if (board->freecells[i] == NO_CARD) {
+            cells++;
+        }
     }
-    if (node->tops[15] != -1) {
-        score += node->tops[15];
-        score++;
+    for (int i = 0; i < 8; i++) {
+        if (i != to && board->len[i] == 0) {
+            empties++;
+        }
     }
 
-    return score * 10;
+    return (cells + 1) << empties;
 }
 
-// Computes the sum of the freestacks of the board.
+// Returns the number of cards a sequence move takes: onto a card, the part of the
+// run that fits on it; to an empty stack, as much of the run as can be moved,
+// leaving at least a card behind.
 // Inputs:
-//      struct tree_node *node: A tree node
+//      struct board *board: A board
+//      int from: Stack moved from
+//      int to: Stack going to
 // Output:
-//      int --> Node score
-int freestacks_count(struct tree_node *node)
+//      int --> Number of cards
+int sequence_length(struct board *board, int from, int to)
 {
-    int score = 0;
-    for (int i = 0; i < 8; i++) {
-        if (node->board[i][node->tops[i]].value == -1) {
-            score++;
-        }
+    if (board->len[to] > 0) {
+        return card_value(top_card(board, to)) - card_value(top_card(board, from));
     }
 
-    return score * 5;
+    int k = run_length(board, from);
+    int capacity = sequence_capacity(board, to);
+    if (k > capacity) {
+        k = capacity;
+    }
+    if (k == board->len[from]) {
+        k--;
+    }
+
+    return k;
 }
 
-// This function returns the score of the current board, based on:
-//  - Num of cards at foundations * 10
-//  - Freestacks count
-//  - Freecells count
-// The score is ncaf - fs - fc. This was generated from the idea that the more
-// spread the cards are, the bigger the chance to get a card to foundations. So
-// the board should not have empty freecells or stacks.
+// Moves the top card of a stack or freecell as one step of a sequence move.
 // Inputs:
-//      struct tree_node *node: A tree node
+//      struct board *board: A board
+//      int from: Stack (0-7) or freecell (8-11) moved from
+//      int to: Stack going to (8 or more: any free freecell)
+//      struct move_record *step: Filled with the step (NULL if not needed)
 // Output:
-//      int --> Node score
-int heuristic(struct tree_node *node)
+//      int --> Number of steps (1)
+int move_card(struct board *board, int from, int to, struct move_record *step)
 {
-    return num_cards_at_foundations(node) - freestacks_count(node) - freecells_count(node);
-}
+    unsigned char c = top_card(board, from);
+    unsigned char target = to < 8 ? top_card(board, to) : NO_CARD;
+    int move = to >= 8 ? freecell : target == NO_CARD ? newstack : stack;
 
-// Evaluates the child node generated by
-// computing the evaluation function value based on the search method used.
-// Inputs:
-//      struct tree_node *child_node: A tree node
-//      int method: Execution algorithm.
-void evaluate_child(struct tree_node *child_node, int method)
-{
-    if (method == best) {
-        child_node->f = heuristic(child_node);
-    } else if (method == astar) {
-        child_node->f = child_node->g + heuristic(child_node);
+    if (move == freecell) {
+        move_to_a_freecell(board, from);
     } else {
-        child_node->f = 0;
+        move_to_stack(board, from, to);
+    }
+    if (step != NULL) {
+        *step = (struct move_record) {move, from, to, c, target, NO_CARD};
     }
+
+    return 1;
 }
 
-// Create Child Node.
+// Moves the top k cards of a stack to another stack one card at a time (a
+// supermove). With enough free freecells, all but the lowest card are parked
+// there. Otherwise the cards above the part the freecells and the other empty
+// stacks can move are first moved to an empty stack the same way, then moved on.
 // Inputs:
-//      struct tree_node *node: Node to create child from
-//      int move: Move to execute
-//      int p: Child index
-//      int method: Execution algorithm.
+//      struct board *board: A board
+//      int k: Number of cards (at most sequence_capacity)
 //      int from: Stack moved from
 //      int to: Stack going to
-void create_child(struct tree_node *current_node, int move, int p, int method, int from, int to)
+//      struct move_record *steps: Filled with the steps (NULL if not needed)
+// Output:
+//      int --> Number of steps
+int move_run(struct board *board, int k, int from, int to, struct move_record *steps)
 {
-    int i, j;
-    struct tree_node *child_node = (struct tree_node*) malloc(sizeof(struct tree_node));
-    if (child_node == NULL) {
-        mem_error = -1;
-        return;
-    }
-    current_node->children[p] = child_node;
+    unsigned char parked[4];
+    int cells = 0, count = 0, spare = -1, i;
 
-    for (i = 0; i < 20; i++) {
-        child_node->children[i] = NULL;
+    for (i = 0; i < 4; i++) {
+        if (board->freecells[i] == NO_CARD) {
+            cells++;
+        }
+    }
+    if (k <= cells + 1) {
+        for (i = 0; i < k - 1; i++) {
+            parked[i] = top_card(board, from);
+            count += move_card(board, from, 8, steps != NULL ? steps + count : NULL);
+        }
+        count += move_card(board, from, to, steps != NULL ? steps + count : NULL);
+        for (i = k - 2; i >= 0; i--) {
+            count += move_card(board, find_card(board, parked[i]), to, steps != NULL ? steps + count : NULL);
+        }
+        return count;
     }
 
-    child_node->parent = current_node;
-    child_node->move = move;
-    child_node->g = current_node->g + 1; // The depth of the new child.
-
-    // Computing the puzzle for the new child.
-    // Copy all positions.
-    for (i = 0; i < 16; i++) {
-        for (j = 0; j < 52; j++) {
-            child_node->board[i][j].suit = current_node->board[i][j].suit;
-            child_node->board[i][j].value = current_node->board[i][j].value;
+    for (i = 0; i < 8; i++) {
+        if (i != to && board->len[i] == 0 && spare < 0) {
+            spare = i;
         }
-        child_node->tops[i] = current_node->tops[i];
     }
+    // The part parked on the spare stack leaves the rest within reach of the others.
+    int m = k - sequence_capacity(board, to) / 2;
+    if (m < 1) {
+        m = 1;
+    }
+    count += move_run(board, m, from, spare, steps);
+    count += move_run(board, k - m, from, to, steps != NULL ? steps + count : NULL);
+    count += move_run(board, m, spare, to, steps != NULL ? steps + count : NULL);
 
-    // Change those that are different.
-    child_node->moved0 = current_node->board[from][current_node->tops[from]];
+    return count;
+}
 
+// This function executes a move on a board.
+// Inputs:
+//      struct board *board: A board
+//      int move: Move to execute
+//      int from: Stack moved from
+//      int to: Stack going to
+// Output:
+//      int --> Number of single-card steps of the move (more than 1 for a sequence)
+int execute_move(struct board *board, int move, int from, int to)
+{
     if (move == foundation) {
-        if (to == 0) {
-            move_to_empty_foundation(child_node, from);
-        } else {
-            move_to_foundation(child_node, from, to);
-        }
+        move_to_foundation(board, from);
     } else if (move == newstack) {
-        move_to_new_stack(child_node, from);
+        move_to_new_stack(board, from);
     } else if (move == stack) {
-        child_node->moved1 = current_node->board[to][current_node->tops[to]];
-        move_to_stack(child_node, from, to);
+        move_to_stack(board, from, to);
+    } else if (move == sequence) {
+        return move_run(board, sequence_length(board, from, to), from, to, NULL);
     } else {
-        move_to_a_freecell(child_node, from);
+        move_to_a_freecell(board, from);
     }
 
-    // Check for loops.
-    if (!check_with_parents(child_node)) {
-        // In case of loop detection, the child is deleted.
-        free(child_node);
-        current_node->children[p] = NULL;
-        return;
-    }
-
-    // Computing the heuristic value
-    evaluate_child(child_node, method);
+    return 1;
 }
 
-// This function expands a leaf-node of the search tree.
+// Sends to the foundations, one after the other, the cards no other card can still
+// need: a card goes home once the opposite-colour cards one lower are home, since
+// only they could be put on it. Such moves never hurt, so they are not searched.
+// Sending a card home only makes more cards safe, so the cards sent do not depend on
+// the order they are found in.
 // Inputs:
-//      struct tree_node *current_node: A leaf-node of the search tree.
-//      int method: Execution algorithm.
-void find_children(struct tree_node *current_node, int method)
+//      struct board *board: A board
+//      unsigned char *cards: Filled with the cards sent, in order (NULL if not needed)
+// Output:
+//      int --> Number of cards sent to the foundations
+int auto_play(struct board *board, unsigned char *cards)
 {
-    int i, j, jj;
-    j = 0;
-    for (i = 0; i < 12; i++) {
-		if ((current_node->tops[i] == -1)) {
-			continue;
-		}
-		// Check for foundation.
-		if (current_node->board[i][current_node->tops[i]].value == 0) {
-		    // Move to an empty foudnation.
-			create_child(current_node, foundation, j, method, i, 0);
-			j++;
-			continue;
-		}
-
-		for (jj = 12; jj < 16; jj++) {
-			if (current_node->board[i][current_node->tops[i]].suit == current_node->board[jj][current_node->tops[jj]].suit) {
-				if (current_node->board[i][current_node->tops[i]].value == current_node->board[jj][current_node->tops[jj]].value + 1) {
-				    // Move to a foundation with cards.
-					create_child(current_node, foundation, j, method, i, jj);
-					j++;
-					break;
-				}
-			}
-		}
-
-		// Check for another stack.
-		for (jj = 0; jj < 8; jj++) {
-		    if ((current_node->tops[jj] == -1)) {
-			    continue;
-		    }
-			if (((current_node->board[i][current_node->tops[i]].suit == HEARTS) || (current_node->board[i][current_node->tops[i]].suit == DIAMONDS))
-			    && ((current_node->board[jj][current_node->tops[jj]].suit == SPADES) || (current_node->board[jj][current_node->tops[jj]].suit == CLUBS))) {
-				if (current_node->board[i][current_node->tops[i]].value == current_node->board[jj][current_node->tops[jj]].value - 1) {
-					create_child(current_node, stack, j, method, i, jj);
-					j++;
-				}
-			} else if (((current_node->board[i][current_node->tops[i]].suit == SPADES) || (current_node->board[i][current_node->tops[i]].suit == CLUBS))
-			            && ((current_node->board[jj][current_node->tops[jj]].suit == HEARTS) || (current_node->board[jj][current_node->tops[jj]].suit == DIAMONDS))) {
-				if (current_node->board[i][current_node->tops[i]].value == current_node->board[jj][current_node->tops[jj]].value - 1) {
-					create_child(current_node, stack, j, method, i, jj);
-					j++;
-				}
-			} else if (current_node->tops[jj] == -1) {
-				create_child(current_node, newstack, j, method, i, jj);
-				j++;
-				break;
-			}
-		}
-
-		if (i != 8 && i != 9 && i != 10 && i != 11) {
-			// Check for a freecell.
-			for (jj = 8; jj < 12; jj++) {
-				if (current_node->tops[jj] == -1) {
-					create_child(current_node, freecell, j, method, i, jj);
-					j++;
-					break;
-				}
-			}
-		}
-	}
+    int count = 0;
+    for (int i = 0; i < 12; i++) {
+        unsigned char c = top_card(board, i);
+        if (c == NO_CARD) {
+            continue;
+        }
+        int s = card_suit(c), v = card_value(c);
+        if (board->foundations[s] != v || board->foundations[(s + 1) & 3] < v || board->foundations[(s + 3) & 3] < v) {
+            continue;
+        }
+        move_to_foundation(board, i);
+        if (cards != NULL) {
+            cards[count] = c;
+        }
+        count++;
+        // The card may uncover another one, or make the other colour safe.
+        i = -1;
+    }
+
+    return count;
 }
 
-// This function initializes the search, i.e. it creates the root node of the search tree
-// and the first node of the frontier.
+// This function executes a move in place, recording in it the exact slot the card
+// went to, so that it can be undone.
 // Inputs:
-//      struct card[16][52] puzzle: The puzzle.
-//      int[16] tops: Board tops array.
-//      int method: Execution algorithm.
-void initialize_search(struct card puzzle[16][52], int tops[16], int method)
+//      struct board *board: A board
+//      struct move_record *m: A legal move of the board
+void make_move(struct board *board, struct move_record *m)
 {
-    int i, j, jj;
-    // Initialize search tree.
-    struct tree_node *root = (struct tree_node*) malloc(sizeof(struct tree_node));
-    if (root == NULL) {
-        printf("Root creation failed.\n");
-        mem_error = -1;
-        return;
-    }
-
-    generate_board(root->board, root->tops);
-    root->parent = NULL;
-    root->move = -1;
-
-    for (jj = 0; jj<20; jj++) {
-        root->children[jj] = NULL;
+    int i;
+    if (m->move == foundation) {
+        m->to = 12 + card_suit(m->moved0);
+    } else if (m->move == newstack) {
+        for (i = 0; i < 8 && board->len[i] != 0; i++);
+        m->to = i;
+    } else if (m->move == freecell) {
+        for (i = 0; i < 4 && board->freecells[i] != NO_CARD; i++);
+        m->to = 8 + i;
     }
+    m->under = card_below(board, m->from, 1);
+    execute_move(board, m->move, m->from, m->to);
+}
 
-    for (i = 0; i < 8; i++) {
-        for (j = 0; j <= tops[i]; j++) {
-            root->board[i][j].suit = puzzle[i][j].suit;
-            root->board[i][j].value = puzzle[i][j].value;
-        }
-        root->tops[i] = tops[i];
+// This function undoes a move executed by make_move, restoring the board exactly.
+// Inputs:
+//      struct board *board: A board
+//      struct move_record *m: The last move executed on the board
+void unmake_move(struct board *board, struct move_record *m)
+{
+    unsigned char c = m->moved0;
+    if (m->move == foundation) {
+        board->foundations[card_suit(c)]--;
+    } else {
+        pop_card(board, m->to);
     }
 
-    root->g = 0;
-    root->h = heuristic(root);
-    if (method == best) {
-        root->f = root->h;
-    } else if (method == astar) {
-        root->f = root->g + root->h;
+    if (m->from >= 8) {
+        board->freecells[m->from - 8] = c;
+        board->hash ^= zobrist_freecell[c];
     } else {
-        root->f = 0;
+        push_card(board, m->from, c);
     }
-
-    #ifdef DEBUG
-        printf("Root puzzle:\n");
-        display_board(root->board, root->tops);
-    #endif
-
-    add_frontier_front(root);
 }
 
-// This function fill the last stack of the board with the remaining cards.
+// Replays the move leading to a node on its parent's board, by card, together with
+// the cards it sent to the foundations (see auto_play).
 // Inputs:
-//      struct tree_node *node: A tree node
-//      int method: Execution algorithm.
+//      struct board *board: The board of the node's parent (or an equal one)
+//      struct tree_node *node: A search-tree node
+//      struct move_record *steps: Filled with the single-card steps (NULL if not needed)
 // Output:
-//      struct tree_node* --> Solution node
-struct tree_node *complete_solution(struct tree_node *node, int method)
+//      int --> Number of steps
+int replay_move(struct board *board, struct tree_node *node, struct move_record *steps)
 {
-    for (int i = 0; i < 12; i++) {
-        if (node->tops[i] == -1) {
-            continue;
+    unsigned char cards[MAX_CARDS];
+    int from, to = 0, count, i;
+
+    if (node->move == sequence) {
+        from = find_stacked_card(board, node->moved0);
+        if (node->moved1 != NO_CARD) {
+            to = find_card(board, node->moved1);
+        } else {
+            for (to = 0; board->len[to] != 0; to++);
+        }
+        count = move_run(board, sequence_length(board, from, to), from, to, steps);
+    } else {
+        from = find_card(board, node->moved0);
+        to = node->move == stack ? find_card(board, node->moved1) : 0;
+        count = execute_move(board, node->move, from, to);
+        if (steps != NULL) {
+            steps[0] = (struct move_record) {node->move, from, to, node->moved0, node->moved1, NO_CARD};
+        }
+    }
+
+    int played = auto_play(board, steps != NULL ? cards : NULL);
+    for (i = 0; steps != NULL && i < played; i++) {
+        steps[count + i] = (struct move_record) {foundation, 0, 12 + card_suit(cards[i]), cards[i], NO_CARD, NO_CARD};
+    }
+
+    return count + played;
+}
+
+// Rebuilds the board of a delta-encoded node, by replaying the moves that lead to
+// it from its closest ancestor that still holds a board (the root or a checkpoint).
+// Moves are replayed by card, so the ancestor's stack order does not matter.
+// Inputs:
+//      struct tree_node *node: A search-tree node
+//      struct board *tmp: Space for the rebuilt board
+// Output:
+//      struct board* --> The node's own board, or tmp holding the rebuilt one
+struct board *node_board(struct tree_node *node, struct board *tmp)
+{
+    if (node->board != NULL) {
+        return node->board;
+    }
+
+    struct board *parent_board = node_board(node->parent, tmp);
+    if (parent_board != tmp) {
+        *tmp = *parent_board;
+    }
+    replay_move(tmp, node, NULL);
+
+    return tmp;
+}
+
+// This function releases the board of an expanded node in delta mode. Only the
+// move that leads to it is kept, except at every checkpoint_interval levels.
+// Inputs:
+//      struct tree_node *node: An expanded search-tree node
+void compact_node(struct tree_node *node)
+{
+    if (checkpoint_interval == 0 || node->parent == NULL || node->g % checkpoint_interval == 0) {
+        return;
+    }
+    pool_free(&board_pool, node->board);
+    node->board = NULL;
+}
+
+// This function checks whether two boards are qual, up to the order of their
+// stacks and freecells.
+// Inputs:
+//      struct tree_node *n: A tree node (child)
+//      struct tree_node *p: Another tree node (parent)
+// Output:
+//      1 --> Nodes are equal
+//      0 --> Nodes are not equal
+int equal_nodes(struct tree_node *n, struct tree_node *p)
+{
+    struct board a, b;
+    struct board *pa = node_board(n, &a);
+    struct board *pb = node_board(p, &b);
+    if (pa != &a) {
+        a = *pa;
+    }
+    if (pb != &b) {
+        b = *pb;
+    }
+    canonicalize_board(&a);
+    canonicalize_board(&b);
+
+    return memcmp(&a, &b, sizeof(struct board)) == 0;
+}
+
+// This function allocates an empty transposition table.
+// Inputs:
+//      struct hash_table *table: The table to initialize
+//      unsigned long size: Initial number of slots (a power of two)
+// Output:
+//      0 --> The table has been allocated successfully
+//     -1 --> Memory problem when allocating the table
+int init_hash_table(struct hash_table *table, unsigned long size)
+{
+    table->slots = (struct hash_slot*) calloc(size, sizeof(struct hash_slot));
+    if (table->slots == NULL) {
+        return -1;
+    }
+    table->size = size;
+    table->count = 0;
+    stats.bytes_allocated += size * sizeof(struct hash_slot);
+
+    return 0;
+}
+
+// This function releases the slots of a transposition table (not the nodes).
+// Inputs:
+//      struct hash_table *table: The table to release
+void free_hash_table(struct hash_table *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->size = 0;
+    table->count = 0;
+}
+
+// This function returns the slot of a transposition table holding a node with the
+// same board, or the empty slot where such a node would be stored.
+// Inputs:
+//      struct hash_table *table: A transposition table
+//      unsigned long long hash: The hash of the node's board
+//      struct tree_node *node: A search tree node (NULL if known to be absent)
+// Output:
+//      struct hash_slot* --> The matching or empty slot
+struct hash_slot *find_slot(struct hash_table *table, unsigned long long hash, struct tree_node *node)
+{
+    unsigned long mask = table->size - 1;
+    unsigned long i = hash & mask;
+    while (table->slots[i].node != NULL) {
+        if (node != NULL && table->slots[i].hash == hash && equal_nodes(node, table->slots[i].node)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &table->slots[i];
+}
+
+// This function doubles the slots of a transposition table, rehashing its nodes.
+// Inputs:
+//      struct hash_table *table: A transposition table
+// Output:
+//      0 --> The table has grown successfully
+//     -1 --> Memory problem when allocating the new slots
+int grow_hash_table(struct hash_table *table)
+{
+    struct hash_table grown;
+    if (over_memory_limit(table->size * sizeof(struct hash_slot)) || init_hash_table(&grown, table->size * 2) < 0) {
+        return -1;
+    }
+
+    for (unsigned long i = 0; i < table->size; i++) {
+        if (table->slots[i].node != NULL) {
+            *find_slot(&grown, table->slots[i].hash, NULL) = table->slots[i];
+        }
+    }
+    grown.count = table->count;
+    free_hash_table(table);
+    *table = grown;
+
+    return 0;
+}
+
+// Computes the f value of astar, the frontier coming in decreasing f order. With a
+// weight w set (see anytime_search), f is w * h - g * IDA_MOVE_COST, h being the
+// value of astar_heuristic: higher scores and shorter paths come first. With a
+// pattern database (and no weight), f is h - g * IDA_MOVE_COST, h being then the
+// negated cost of the moves left (see astar_heuristic). Otherwise f is g + h.
+// Inputs:
+//      int g: The depth of the node
+//      int h: The heuristic value of its board
+// Output:
+//      int --> The f value
+int astar_f(int g, int h)
+{
+    if (search_weight > 0) {
+        return search_weight * h - IDA_MOVE_COST * g;
+    } else if (pdb_table != NULL) {
+        return h - IDA_MOVE_COST * g;
+    }
+
+    return g + h;
+}
+
+// This function removes a node from a transposition table. The nodes following it
+// in the probe sequence are shifted back, so no tombstone is left.
+// Inputs:
+//      struct hash_table *table: A transposition table
+//      struct tree_node *node: The node (nothing is done if the table does not hold it)
+void remove_node(struct hash_table *table, struct tree_node *node)
+{
+    unsigned long mask = table->size - 1;
+    unsigned long i = node->board->hash & mask;
+    unsigned long j;
+    while (table->slots[i].node != node) {
+        if (table->slots[i].node == NULL) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    table->slots[i].node = NULL;
+    table->count--;
+
+    j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (table->slots[j].node == NULL) {
+            return;
+        }
+        // The node at j may move to i only if i lies between its home slot and j.
+        unsigned long home = table->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            table->slots[i] = table->slots[j];
+            table->slots[j].node = NULL;
+            i = j;
+        }
+    }
+}
+
+// This function looks a new search tree node up in the transposition table.
+// If no node with the same board was met before, the new node is stored.
+// For A*, an already met board is re-opened when the new node reaches it with a
+// smaller g, in which case the new node replaces the old one in the table.
+// Inputs:
+//      struct hash_table *table: A transposition table
+//      struct tree_node *new_node: A search tree node (usually a new one)
+//      int method: Execution algorithm.
+// Output:
+//      1 --> The node is new (or re-opened) and must be added to the frontier
+//      0 --> Duplicate detection (the frontier may have been updated with the cheaper path)
+//     -1 --> Memory problem when growing the table
+int check_visited(struct hash_table *table, struct tree_node *new_node, int method)
+{
+    if (2 * (table->count + 1) > table->size && grow_hash_table(table) < 0) {
+        return -1;
+    }
+
+    struct hash_slot *slot = find_slot(table, new_node->board->hash, new_node);
+    if (slot->node == NULL) {
+        slot->hash = new_node->board->hash;
+        slot->node = new_node;
+        table->count++;
+        return 1;
+    }
+
+    if (method == astar && new_node->g < slot->node->g) {
+        struct tree_node *old_node = slot->node;
+        if (old_node->heap_index >= 0) {
+            // Still in the frontier: the old node takes the cheaper path (decrease-key).
+            if (memory_bounded) {
+                old_node->parent->children--;
+                new_node->parent->children++;
+            }
+            old_node->parent = new_node->parent;
+            old_node->move = new_node->move;
+            old_node->moved0 = new_node->moved0;
+            old_node->moved1 = new_node->moved1;
+            old_node->under = new_node->under;
+            old_node->g = new_node->g;
+            old_node->f = astar_f(old_node->g, old_node->h);
+            heap_update(old_node);
+            return 0;
+        }
+        // Already expanded: the board is re-opened through the new node.
+        slot->node = new_node;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Computes the sum of the freecells of the board.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Board score
+int freecells_count(struct board *board)
+{
+    int score = 0;
+    for (int i = 0; i < 4; i++) {
+        if (board->freecells[i] == NO_CARD) {
+            score++;
+        }
+    }
+
+    return score;
+}
+
+// Computes the sum of the cards at foundations of the board.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Board score
+int num_cards_at_foundations(struct board *board)
+{
+    int score = board->foundations[HEARTS] + board->foundations[SPADES]
+                + board->foundations[DIAMONDS] + board->foundations[CLUBS];
+
+    return score * 10;
+}
+
+// Counts the cards of the board not at the foundations yet.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Number of cards
+int cards_left(struct board *board)
+{
+    return 4 * N - board->foundations[HEARTS] - board->foundations[SPADES]
+           - board->foundations[DIAMONDS] - board->foundations[CLUBS];
+}
+
+// Computes the sum of the freestacks of the board.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Board score
+int freestacks_count(struct board *board)
+{
+    int score = 0;
+    for (int i = 0; i < 8; i++) {
+        if (board->len[i] == 0) {
+            score++;
+        }
+    }
+
+    return score * 5;
+}
+
+// This function returns the score of the current board, based on:
+//  - Num of cards at foundations * 10
+//  - Freestacks count
+//  - Freecells count
+// The score is ncaf - fs - fc. This was generated from the idea that the more
+// spread the cards are, the bigger the chance to get a card to foundations. So
+// the board should not have empty freecells or stacks.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Board score
+int heuristic(struct board *board)
+{
+    return num_cards_at_foundations(board) - freestacks_count(board) - freecells_count(board);
+}
+
+// Returns the index of an abstract state in the pattern database: the codes of the
+// window cards of a suit, as the digits of a number in base PDB_RADIX.
+// Inputs:
+//      int *codes: The code of each window card (PDB_WINDOW codes)
+// Output:
+//      int --> The index
+int pdb_index(int *codes)
+{
+    int index = 0;
+    for (int i = PDB_WINDOW - 1; i >= 0; i--) {
+        index = index * PDB_RADIX + codes[i];
+    }
+
+    return index;
+}
+
+// Returns a lower bound on the moves left to solve a board, read from the pattern
+// database. Each suit is abstracted to its window, the next PDB_WINDOW cards to go
+// home: where each of them lies relative to the others, the other cards removed.
+// The database holds the moves the window needs in this abstraction, and every card
+// past the window needs at least its move home. A move moves a single card, so the
+// bounds of the four suits add up.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Number of moves
+int pdb_cost(struct board *board)
+{
+    int codes[4][PDB_WINDOW];
+    int last[4];
+    int cost = 0;
+    int i, j, s, k = 0;
+
+    // A window card not found in the stacks is at a freecell.
+    for (s = 0; s < 4; s++) {
+        for (i = 0; i < PDB_WINDOW; i++) {
+            codes[s][i] = board->foundations[s] + i >= N ? PDB_HOME : PDB_FREECELL;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        last[0] = last[1] = last[2] = last[3] = PDB_BOTTOM;
+        for (j = 0; j < board->len[i]; j++, k++) {
+            unsigned char c = board->cards[k];
+            s = card_suit(c);
+            int w = card_value(c) - board->foundations[s];
+            if (w < PDB_WINDOW) {
+                codes[s][w] = last[s];
+                last[s] = w + 1;
+            }
+        }
+    }
+
+    for (s = 0; s < 4; s++) {
+        cost += pdb_table[pdb_index(codes[s])];
+        if (N - board->foundations[s] > PDB_WINDOW) {
+            cost += N - board->foundations[s] - PDB_WINDOW;
+        }
+    }
+
+    return cost;
+}
+
+// Maps the pattern database in memory, checking only its header.
+// Inputs:
+//      char *filename: The database file
+// Output:
+//      0 --> The database is loaded
+//     -1 --> The file cannot be mapped or is not a database of this build
+int load_pdb(char *filename)
+{
+    struct pdb_header *header;
+    struct stat st;
+    size_t size = sizeof(struct pdb_header) + PDB_ENTRIES;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size != size) {
+        printf("Cannot load the pattern database %s (run make pdb).\n", filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    header = (struct pdb_header*) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        printf("Cannot map the pattern database %s.\n", filename);
+        return -1;
+    }
+    if (memcmp(header->magic, PDB_MAGIC, sizeof(header->magic)) != 0 || header->window != PDB_WINDOW
+        || header->entries != size - sizeof(struct pdb_header)) {
+        printf("%s is not a pattern database of this build (run make pdb).\n", filename);
+        munmap(header, size);
+        return -1;
+    }
+    pdb_table = (unsigned char*) (header + 1);
+
+    return 0;
+}
+
+// The heuristic of astar: the heuristic score, or with a pattern database the moves
+// it bounds, in heuristic units and negated (higher is still better).
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> The heuristic value
+int astar_heuristic(struct board *board)
+{
+    if (pdb_table != NULL) {
+        return -IDA_MOVE_COST * pdb_cost(board);
+    }
+
+    return heuristic(board);
+}
+
+// Evaluates the child node generated by
+// computing the evaluation function value based on the search method used.
+// Inputs:
+//      struct tree_node *child_node: A tree node
+//      int method: Execution algorithm.
+void evaluate_child(struct tree_node *child_node, int method)
+{
+    if (method == best || method == beam) {
+        child_node->h = heuristic(child_node->board);
+        child_node->f = child_node->h;
+    } else if (method == astar) {
+        child_node->h = astar_heuristic(child_node->board);
+        child_node->f = astar_f(child_node->g, child_node->h);
+    } else {
+        child_node->h = 0;
+        child_node->f = 0;
+    }
+}
+
+// Creates the node reached by executing a move, without any check.
+// Inputs:
+//      struct tree_node *node: Node to create child from
+//      int move: Move to execute
+//      int from: Stack moved from
+//      int to: Stack going to
+// Output:
+//      NULL --> Memory exhausted (mem_error is set)
+//      struct tree_node* --> The new node
+struct tree_node *apply_move(struct tree_node *current_node, int move, int from, int to)
+{
+    struct tree_node *child_node = (struct tree_node*) pool_alloc(&tree_pool);
+    if (child_node == NULL) {
+        mem_error = -1;
+        return NULL;
+    }
+    child_node->board = (struct board*) pool_alloc(&board_pool);
+    if (child_node->board == NULL) {
+        pool_free(&tree_pool, child_node);
+        mem_error = -1;
+        return NULL;
+    }
+
+    stats.generated++;
+    child_node->parent = current_node;
+    child_node->move = move;
+    child_node->heap_index = -1;
+    child_node->children = 0;
+    child_node->g = current_node->g;
+
+    // Computing the puzzle for the new child.
+    // Copy all positions.
+    *child_node->board = *current_node->board;
+
+    // Change those that are different.
+    child_node->moved0 = top_card(current_node->board, from);
+    child_node->moved1 = move == stack ? top_card(current_node->board, to) : NO_CARD;
+    child_node->under = card_below(current_node->board, from, 1);
+    if (move == sequence) {
+        struct board *board = current_node->board;
+        int k = sequence_length(board, from, to);
+        child_node->moved0 = board->cards[stack_start(board, from) + board->len[from] - k];
+        child_node->moved1 = top_card(board, to);
+        child_node->under = card_below(board, from, k);
+    }
+    // The single-card steps of the move, and the moves played automatically, count in
+    // the depth, which is the length of the path.
+    child_node->g += execute_move(child_node->board, move, from, to);
+    child_node->g += auto_play(child_node->board, NULL);
+
+    return child_node;
+}
+
+// Checks a new node against the transposition table and evaluates it.
+// Inputs:
+//      struct tree_node *child_node: A new search-tree node
+//      int method: Execution algorithm.
+// Output:
+//      NULL --> Duplicate board (the node is deleted) or memory exhausted (mem_error is set)
+//      struct tree_node* --> The new child
+struct tree_node *admit_child(struct tree_node *child_node, int method)
+{
+    // Check for boards already met anywhere in the search.
+    double t = stats_clock();
+    int err = check_visited(&visited, child_node, method);
+    stats.visited_time += stats_clock() - t;
+    if (err <= 0) {
+        // In case of duplicate detection, the child is deleted.
+        pool_free(&board_pool, child_node->board);
+        pool_free(&tree_pool, child_node);
+        if (err < 0) {
+            mem_error = -1;
+        } else {
+            stats.duplicates++;
+        }
+        return NULL;
+    }
+
+    // Computing the heuristic value
+    t = stats_clock();
+    evaluate_child(child_node, method);
+    stats.evaluation_time += stats_clock() - t;
+
+    return child_node;
+}
+
+// Deletes a new node whose board cannot be solved (see dead_end).
+// Inputs:
+//      struct tree_node *child_node: A new search-tree node
+// Output:
+//      1 --> The node was deleted
+//      0 --> The node is kept
+int discard_dead_end(struct tree_node *child_node)
+{
+    if (!dead_end(child_node->board)) {
+        return 0;
+    }
+    pool_free(&board_pool, child_node->board);
+    pool_free(&tree_pool, child_node);
+    stats.dead_ends++;
+
+    return 1;
+}
+
+// Create Child Node.
+// Inputs:
+//      struct tree_node *node: Node to create child from
+//      int move: Move to execute
+//      int method: Execution algorithm.
+//      int from: Stack moved from
+//      int to: Stack going to
+// Output:
+//      NULL --> Duplicate or unsolvable board, or memory exhausted (mem_error is set)
+//      struct tree_node* --> The new child
+struct tree_node *create_child(struct tree_node *current_node, int move, int method, int from, int to)
+{
+    double t = stats_clock();
+    struct tree_node *child_node = apply_move(current_node, move, from, to);
+    stats.move_time += stats_clock() - t;
+    if (child_node == NULL || discard_dead_end(child_node)) {
+        return NULL;
+    }
+
+    return admit_child(child_node, method);
+}
+
+// This function indexes the places of a board that its moves depend on.
+// Inputs:
+//      struct board *board: A board
+//      struct move_index *index: Filled with the index
+void index_board(struct board *board, struct move_index *index)
+{
+    int i, start = 0;
+
+    index->tops = 0;
+    index->home = 0;
+    for (i = 0; i < 8; i++) {
+        start += board->len[i];
+        index->top[i] = board->len[i] > 0 ? board->cards[start - 1] : NO_CARD;
+        if (board->len[i] > 0) {
+            index->tops |= card_bit(index->top[i]);
+            index->stack_of[index->top[i]] = i;
+        }
+    }
+    index->free_cell = -1;
+    for (i = 3; i >= 0; i--) {
+        index->top[8 + i] = board->freecells[i];
+        if (board->freecells[i] == NO_CARD) {
+            index->free_cell = 8 + i;
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        if (board->foundations[i] < N) {
+            index->home |= card_bit(make_card(i, board->foundations[i]));
+        }
+    }
+}
+
+// This function lists the legal moves of a board. The stacks a card can go to are
+// those of card_targets among the top cards: at most two, listed in stack order.
+// Single cards never go to an empty stack (runs do, see generate_sequence_moves).
+// Inputs:
+//      struct board *board: A board
+//      struct move_record moves[MAX_CHILDREN]: Table filled with the moves
+// Output:
+//      int --> Number of moves
+int generate_moves(struct board *board, struct move_record moves[MAX_CHILDREN])
+{
+    struct move_index index;
+    unsigned long long targets;
+    unsigned char c, first, second;
+    int i, j = 0;
+
+    index_board(board, &index);
+    for (i = 0; i < 12; i++) {
+        c = index.top[i];
+        if (c == NO_CARD) {
+            continue;
+        }
+        // Check for foundation.
+        if (index.home & card_bit(c)) {
+            moves[j++] = (struct move_record) {foundation, i, 12 + card_suit(c), c, NO_CARD, NO_CARD};
+            if (card_value(c) == 0) {
+                continue;
+            }
+        }
+
+        // Check for another stack.
+        targets = card_targets[c] & index.tops;
+        if (targets != 0) {
+            first = __builtin_ctzll(targets);
+            targets &= targets - 1;
+            if (targets != 0) {
+                second = __builtin_ctzll(targets);
+                if (index.stack_of[second] < index.stack_of[first]) {
+                    second = first;
+                    first = __builtin_ctzll(targets);
+                }
+                moves[j++] = (struct move_record) {stack, i, index.stack_of[first], c, first, NO_CARD};
+                first = second;
+            }
+            moves[j++] = (struct move_record) {stack, i, index.stack_of[first], c, first, NO_CARD};
+        }
+
+        // Check for a freecell.
+        if (i < 8 && index.free_cell >= 0) {
+            moves[j++] = (struct move_record) {freecell, i, index.free_cell, c, NO_CARD, NO_CARD};
+        }
+    }
+
+    return j;
+}
+
+// This function lists the sequence moves of a board: a run of cards on top of a
+// stack moved onto a card it fits on, or to an empty stack, as long as the free
+// freecells and empty stacks let it be done one card at a time (see move_run).
+// Inputs:
+//      struct board *board: A board
+//      struct move_record *moves: Table filled with the moves (MAX_SEQUENCE_MOVES)
+// Output:
+//      int --> Number of moves
+int generate_sequence_moves(struct board *board, struct move_record *moves)
+{
+    int i, jj, j = 0;
+    for (i = 0; i < 8; i++) {
+        int run = run_length(board, i);
+        if (run < 2) {
+            continue;
+        }
+        int bottom = stack_start(board, i) + board->len[i];
+        int empty = 0;
+        for (jj = 0; jj < 8; jj++) {
+            if (jj == i) {
+                continue;
+            }
+            int k = sequence_length(board, i, jj);
+            if (board->len[jj] == 0) {
+                // Empty stacks are all alike, and a whole stack would only change places.
+                if (!empty && k >= 2 && k < board->len[i]) {
+                    moves[j++] = (struct move_record) {sequence, i, jj, board->cards[bottom - k], NO_CARD, NO_CARD};
+                }
+                empty = 1;
+                continue;
+            }
+            unsigned char target = top_card(board, jj);
+            if (k < 2 || k > run || !card_fits(board->cards[bottom - k], target)
+                || k > sequence_capacity(board, jj)) {
+                continue;
+            }
+            moves[j++] = (struct move_record) {sequence, i, jj, board->cards[bottom - k], target, NO_CARD};
+        }
+    }
+
+    return j;
+}
+
+// This function returns the next legal move of a board. Moves come in the reverse
+// of the generate_moves order: last source first, and for each source the freecell
+// move, the stack moves (last stack first) and then the foundation move.
+// Inputs:
+//      struct board *board: A board
+//      struct move_iterator *it: Iterator state, initialized by {11, 7, 0}
+//      struct move_record *m: Filled with the move
+// Output:
+//      1 --> A move was returned
+//      0 --> No moves left
+int next_move(struct board *board, struct move_iterator *it, struct move_record *m)
+{
+    int i;
+    unsigned char c, target;
+    while (it->from >= 0) {
+        c = top_card(board, it->from);
+        if (c == NO_CARD || (card_value(c) == 0 && it->phase < 2)) {
+            // Aces only go to the foundations.
+            it->phase = c == NO_CARD ? 3 : 2;
+        }
+
+        if (it->phase == 0) {
+            // Check for a freecell.
+            it->phase = 1;
+            it->to = 7;
+            if (it->from < 8) {
+                for (i = 0; i < 4 && board->freecells[i] != NO_CARD; i++);
+                if (i < 4) {
+                    *m = (struct move_record) {freecell, it->from, 8 + i, c, NO_CARD, NO_CARD};
+                    return 1;
+                }
+            }
+        } else if (it->phase == 1) {
+            // Check for another stack.
+            while (it->to >= 0) {
+                target = top_card(board, it->to--);
+                if (target != NO_CARD && card_fits(c, target)) {
+                    *m = (struct move_record) {stack, it->from, it->to + 1, c, target, NO_CARD};
+                    return 1;
+                }
+            }
+            it->phase = 2;
+        } else if (it->phase == 2) {
+            // Check for foundation.
+            it->phase = 3;
+            if (board->foundations[card_suit(c)] == card_value(c)) {
+                *m = (struct move_record) {foundation, it->from, 12 + card_suit(c), c, NO_CARD, NO_CARD};
+                return 1;
+            }
+        } else {
+            it->from--;
+            it->phase = 0;
+        }
+    }
+
+    return 0;
+}
+
+// This function checks whether a move is redundant after the previous one, so that
+// it is skipped before any board is built. That is the case when:
+// - it takes the card of the previous move back where it came from;
+// - order is set and both are single-card moves that touch different cards and
+//   places: played the other way round they reach the same board, so only the
+//   order moving the higher card last is kept.
+// The order rule needs the previous move to be the one actually played on the path
+// searched from the board. That holds in IDA*, which keeps no transposition table,
+// and in the external search, whose records keep the move of their own path and
+// whose layers hold every board of a depth: a board left out in one order is
+// still found, at the same depth, in the other. Sequence moves to an empty stack
+// never take a whole stack (see generate_sequence_moves).
+// Inputs:
+//      struct move_record *last: The previous move (with its under card)
+//      int order: Whether the order rule applies
+//      struct move_record *m: A legal move of the board
+// Output:
+//      1 --> The move is redundant
+//      0 --> The move is kept
+int redundant_move(struct move_record *last, int order, struct move_record *m)
+{
+    if (m->moved0 == last->moved0) {
+        // The same card again: only its way back is redundant.
+        if (last->under == FROM_FREECELL) {
+            return m->move == freecell;
+        }
+        if (last->under == NO_CARD) {
+            return m->moved1 == NO_CARD && (m->move == newstack || m->move == sequence);
+        }
+        return m->moved1 == last->under;
+    }
+
+    if (!order || last->move == sequence || last->move == newstack || m->move == sequence || m->move == newstack) {
+        return 0;
+    }
+    // The move depends on the previous one if it moves the card uncovered, lands on
+    // either card, needs the freecell just freed or follows it to the foundations.
+    if (m->moved0 == last->under
+        || (m->move == stack && (m->moved1 == last->moved0 || m->moved1 == last->under))
+        || (m->move == freecell && last->under == FROM_FREECELL)
+        || (m->move == foundation && last->move == foundation && card_suit(m->moved0) == card_suit(last->moved0))) {
+        return 0;
+    }
+
+    return m->moved0 < last->moved0;
+}
+
+// Checks a move of a node's board against the move leading to the node (see
+// redundant_move), counting it when redundant. That move is the one of the first
+// path to the board, so only its way back is pruned, not the other order.
+// Inputs:
+//      struct tree_node *node: A search-tree node
+//      struct move_record *m: A legal move of its board
+// Output:
+//      1 --> The move is redundant
+//      0 --> The move is kept
+int redundant_child(struct tree_node *node, struct move_record *m)
+{
+    if (node->parent == NULL) {
+        return 0;
+    }
+    struct move_record last = {node->move, 0, 0, node->moved0, node->moved1, node->under};
+    if (!redundant_move(&last, 0, m)) {
+        return 0;
+    }
+    stats.redundant++;
+
+    return 1;
+}
+
+// This function starts the expansion of a leaf-node of the search tree. Only the
+// moves of its board are listed: next_child builds its children one at a time.
+// Inputs:
+//      struct tree_node *current_node: A leaf-node of the search tree.
+//      int method: Execution algorithm.
+//      struct child_iterator *it: Iterator state, filled with the moves
+void start_children(struct tree_node *current_node, int method, struct child_iterator *it)
+{
+    double t = stats_clock();
+    it->count = generate_moves(current_node->board, it->moves);
+    if (method != breadth) {
+        // Levels of breadth would only widen: a sequence ends in a board its steps reach anyway.
+        it->count += generate_sequence_moves(current_node->board, it->moves + it->count);
+    }
+    stats.move_time += stats_clock() - t;
+    it->next = 0;
+}
+
+// This function builds the next child of a node being expanded (see start_children).
+// Redundant moves, duplicate and unsolvable boards are skipped. So are, before any
+// board is copied, the moves that cannot lead to a solution shorter than bound: every
+// move adds a step to g, and only a foundation move (or one played automatically
+// after it) sends a card home in return.
+// Inputs:
+//      struct tree_node *current_node: A node being expanded.
+//      int method: Execution algorithm.
+//      struct child_iterator *it: Iterator state
+//      int bound: Length of the best solution found so far (INT_MAX: none)
+// Output:
+//      NULL --> No children left, or memory exhausted (mem_error is set)
+//      struct tree_node* --> The next child
+struct tree_node *next_child(struct tree_node *current_node, int method, struct child_iterator *it, int bound)
+{
+    struct tree_node *child;
+    int reach = bound < INT_MAX ? current_node->g + cards_left(current_node->board) : 0;
+
+    while (it->next < it->count) {
+        struct move_record *m = &it->moves[it->next++];
+        if (reach + (m->move != foundation) >= bound || redundant_child(current_node, m)) {
+            continue;
+        }
+        if ((child = create_child(current_node, m->move, method, m->from, m->to)) != NULL) {
+            return child;
+        }
+        if (mem_error == -1) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// This function initializes the search, i.e. it creates the root node of the search tree
+// and the first node of the frontier. Running out of memory sets mem_error.
+// Inputs:
+//      struct board *puzzle: The puzzle.
+//      int method: Execution algorithm.
+void initialize_search(struct board *puzzle, int method)
+{
+    // Initialize search tree.
+    struct tree_node *root = (struct tree_node*) pool_alloc(&tree_pool);
+    if (root == NULL || (root->board = (struct board*) pool_alloc(&board_pool)) == NULL) {
+        printf("Root creation failed.\n");
+        mem_error = -1;
+        return;
+    }
+
+    *root->board = *puzzle;
+    root->parent = NULL;
+    root->move = -1;
+    root->heap_index = -1;
+    root->children = 0;
+
+    root->g = 0;
+    root->h = method == astar ? astar_heuristic(root->board) : heuristic(root->board);
+    if (method == best) {
+        root->f = root->h;
+    } else if (method == astar) {
+        root->f = astar_f(root->g, root->h);
+    } else {
+        root->f = 0;
+    }
+
+    #ifdef DEBUG
+        printf("Root puzzle:\n");
+        display_board(root->board);
+    #endif
+
+    if (init_hash_table(&visited, 1024) < 0) {
+        printf("Transposition table creation failed.\n");
+        mem_error = -1;
+        return;
+    }
+    if (check_visited(&visited, root, method) < 0) {
+        printf("Transposition table creation failed.\n");
+        mem_error = -1;
+        return;
+    }
+
+    int err;
+    if (method == best || method == astar) {
+        err = add_frontier_in_order(root);
+    } else {
+        err = add_frontier_front(root);
+    }
+    if (err < 0) {
+        printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
+        mem_error = -1;
+    }
+}
+
+// Checks whether expanding one more board could take the search structures over the
+// memory limit: new slabs for its children, a larger frontier heap or a larger transposition table.
+// Output:
+//      1 --> The next expansion may go over the limit
+//      0 --> It fits
+int memory_pressure()
+{
+    size_t extra = 0;
+    size_t reserve = MAX_CHILDREN + MAX_CARDS;
+
+    if (tree_pool.spare + (SLAB_SIZE - tree_pool.used) / tree_pool.object_size < reserve) {
+        extra += SLAB_SIZE;
+    }
+    if (board_pool.spare + (SLAB_SIZE - board_pool.used) / board_pool.object_size < reserve) {
+        extra += SLAB_SIZE;
+    }
+    if (frontier_heap.count + MAX_CHILDREN > frontier_heap.capacity) {
+        extra += (frontier_heap.capacity > 0 ? frontier_heap.capacity : 1024) * sizeof(struct tree_node*);
+    }
+    if (2 * (visited.count + MAX_CHILDREN) > visited.size) {
+        extra += visited.size * sizeof(struct hash_slot);
+    }
+
+    return extra > 0 && over_memory_limit(extra);
+}
+
+// Orders the nodes of the frontier as the heap does, the first one first.
+// Inputs:
+//      const void *a: Pointer to a search-tree node pointer
+//      const void *b: Pointer to another search-tree node pointer
+// Output:
+//      <0 --> Node a comes first
+//      >0 --> Node b comes first
+int compare_frontier(const void *a, const void *b)
+{
+    struct tree_node *x = *(struct tree_node**) a;
+    struct tree_node *y = *(struct tree_node**) b;
+
+    return heap_before(y, x) - heap_before(x, y);
+}
+
+// This function makes room in memory-bounded mode, SMA*-style. The boards that come
+// last in the frontier order (dead ends first) are dropped, up to an eighth of the
+// frontier, their nodes and boards going back to their pools. Only leaves go: a board
+// with children still in the tree stays. The f of a dropped board is backed up into
+// its parent, which goes back to the frontier (if not already there) to generate it
+// again when its turn comes, and becomes a leaf itself once all its children are dropped.
+// Output:
+//      int --> Number of boards dropped
+int forget_frontier()
+{
+    struct tree_node **nodes = frontier_heap.nodes;
+    int count = frontier_heap.count;
+    int target = count / 8 + MAX_CHILDREN + MAX_CARDS;
+    int kept = 0;
+    int dropped = 0;
+
+    // Move the leaves to the end and sort them, then mark the worst ones (heap_index -1).
+    int leaves = count;
+    for (int i = count - 1; i >= 0; i--) {
+        if (nodes[i]->children == 0 && nodes[i]->parent != NULL) {
+            struct tree_node *leaf = nodes[i];
+            nodes[i] = nodes[--leaves];
+            nodes[leaves] = leaf;
+        }
+    }
+    qsort(nodes + leaves, count - leaves, sizeof(struct tree_node*), compare_frontier);
+    for (int i = count - 1; i >= leaves && dropped < target; i--) {
+        nodes[i]->heap_index = -1;
+        dropped++;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct tree_node *node = nodes[i];
+        struct tree_node *parent = node->parent;
+        if (node->heap_index >= 0) {
+            nodes[kept++] = node;
+            continue;
+        }
+
+        // The parent (never a marked leaf) takes the best f of its forgotten children.
+        // At most one parent is added per dropped board, so kept never overtakes i.
+        if (parent->heap_index < 0) {
+            parent->f = node->f;
+            parent->heap_index = kept;
+            nodes[kept++] = parent;
+        } else if (node->f > parent->f) {
+            parent->f = node->f;
+        }
+        parent->children--;
+        remove_node(&visited, node);
+        pool_free(&board_pool, node->board);
+        pool_free(&tree_pool, node);
+    }
+
+    // The heap is rebuilt by inserting its nodes again, one after the other.
+    frontier_heap.count = 0;
+    for (int i = 0; i < kept; i++) {
+        heap_place(nodes[i], frontier_heap.count++);
+        heap_update(nodes[i]);
+    }
+    count_frontier(kept - count);
+    stats.forgotten += dropped;
+
+    return dropped;
+}
+
+// This function implements at the higest level the search algorithms.
+// The various search algorithms differ only in the way the insert
+// new nodes into the frontier, so most of the code is commmon for all algorithms.
+// Breadth expands level by level, but auto_play folds several moves into one step,
+// so its solution has the fewest steps, not always the fewest moves.
+// Inputs:
+//      int method: Execution algorithm.
+// Output:
+//      NULL --> The problem cannot be solved
+//      struct tree_node* --> A pointer to a search-tree leaf node that corresponds to a solution.
+struct tree_node *search(int method)
+{
+    int err;
+    struct tree_node *current_node, *child;
+    struct child_iterator it;
+
+    // Extract the first node from the frontier, until it is empty.
+    while ((current_node = pop_frontier(method)) != NULL) {
+        if (stats.expanded >= next_poll && budget_exceeded()) {
+            return NULL;
+        }
+
+        // Check if its a solution
+        if (is_solution(current_node->board)) {
+            return current_node;
+        }
+
+        // In memory-bounded mode, dead ends come last: only they are left.
+        if (memory_bounded && current_node->f == INT_MIN) {
+            return NULL;
+        }
+
+        // Add the children of the frontier node to the frontier, each one as soon as
+        // it is built.
+        start_children(current_node, method, &it);
+        stats.expanded++;
+        while ((child = next_child(current_node, method, &it, INT_MAX)) != NULL) {
+            if (memory_bounded) {
+                current_node->children++;
+            }
+            double t = stats_clock();
+            if (method == depth) {
+                err = add_frontier_front(child);
+            } else if (method == breadth) {
+                err = add_frontier_back(child);
+            } else {
+                err = add_frontier_in_order(child);
+            }
+            stats.insertion_time += stats_clock() - t;
+            if (err < 0) {
+                printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
+                return NULL;
+            }
+        }
+        if (mem_error == -1) {
+            printf("Memory exhausted while creating new child node. Search is terminated...\n");
+            return NULL;
+        }
+        compact_node(current_node);
+
+        if (memory_bounded && current_node->children == 0) {
+            // A dead end (its children were all duplicates, or dropped) would pin its
+            // path in memory. It goes back to the frontier, last, for forget_frontier.
+            current_node->f = INT_MIN;
+            if (add_frontier_in_order(current_node) < 0) {
+                printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
+                return NULL;
+            }
+        }
+
+        // Make room before the next expansion, if it may not fit.
+        if (memory_bounded && memory_pressure()) {
+            forget_frontier();
+        }
+    }
+
+    return NULL;
+}
+
+// Orders the children of a beam level: higher heuristic values first, then in the
+// order they were generated.
+// Inputs:
+//      const void *a: Pointer to a search-tree node pointer
+//      const void *b: Pointer to another search-tree node pointer
+// Output:
+//      <0 --> Node a comes first
+//      >0 --> Node b comes first
+int compare_beam(const void *a, const void *b)
+{
+    struct tree_node *x = *(struct tree_node**) a;
+    struct tree_node *y = *(struct tree_node**) b;
+
+    if (x->h != y->h) {
+        return x->h > y->h ? -1 : 1;
+    }
+
+    return x->seq < y->seq ? -1 : 1;
+}
+
+// Moves a child of a beam level up or down the heap of candidates, which keeps the
+// one that comes last (see compare_beam) at its root.
+// Inputs:
+//      struct tree_node **nodes: The candidates
+//      int count: Number of candidates
+//      int i: Position of the child to place
+void beam_update(struct tree_node **nodes, int count, int i)
+{
+    struct tree_node *node = nodes[i];
+    int child;
+
+    // Sift up.
+    while (i > 0 && compare_beam(&node, &nodes[(i - 1) / 2]) > 0) {
+        nodes[i] = nodes[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    // Sift down.
+    while ((child = 2 * i + 1) < count) {
+        if (child + 1 < count && compare_beam(&nodes[child + 1], &nodes[child]) > 0) {
+            child++;
+        }
+        if (compare_beam(&nodes[child], &node) < 0) {
+            break;
+        }
+        nodes[i] = nodes[child];
+        i = child;
+    }
+
+    nodes[i] = node;
+}
+
+// This function implements beam search. The frontier holds a single level of the
+// search tree. All its boards are expanded, and only the beam_width best children
+// (by heuristic) make the next level. They are kept in a heap as the level is
+// expanded: a child that does not make it, when built or pushed out by a better
+// one, keeps its place in the transposition table, so it is not met again, but
+// gives back its board at once, which node_board can rebuild from its parent.
+// Only the boards kept per level are bounded (by beam_width): the nodes left out
+// stay in the tree until release_search. Completeness is lost: the beam may empty without a
+// solution.
+// Output:
+//      NULL --> No solution found (the beam emptied, or the search was interrupted)
+//      struct tree_node* --> A pointer to a search-tree leaf node that corresponds to a solution.
+struct tree_node *beam_search()
+{
+    int i, count, generated, level_count = 1;
+    struct tree_node *current_node, *child;
+    struct tree_node **candidates;
+    struct child_iterator it;
+
+    candidates = (struct tree_node**) malloc((size_t) beam_width * sizeof(struct tree_node*));
+    if (candidates == NULL) {
+        printf("Memory exhausted while creating the beam. Search is terminated...\n");
+        mem_error = -1;
+        return NULL;
+    }
+    stats.bytes_allocated += (size_t) beam_width * sizeof(struct tree_node*);
+
+    while (level_count > 0) {
+        // Expand the whole level.
+        count = 0;
+        generated = 0;
+        for (i = 0; i < level_count; i++) {
+            current_node = pop_frontier(beam);
+            if (stats.expanded >= next_poll && budget_exceeded()) {
+                free(candidates);
+                return NULL;
+            }
+
+            if (is_solution(current_node->board)) {
+                free(candidates);
+                return current_node;
+            }
+
+            start_children(current_node, beam, &it);
+            stats.expanded++;
+            while ((child = next_child(current_node, beam, &it, INT_MAX)) != NULL) {
+                double t = stats_clock();
+                child->seq = generated++;
+                if (count < beam_width) {
+                    candidates[count++] = child;
+                    beam_update(candidates, count, count - 1);
+                } else {
+                    if (compare_beam(&child, &candidates[0]) < 0) {
+                        // The child takes the place of the last candidate.
+                        struct tree_node *last = candidates[0];
+                        candidates[0] = child;
+                        beam_update(candidates, count, 0);
+                        child = last;
+                    }
+                    pool_free(&board_pool, child->board);
+                    child->board = NULL;
+                }
+                stats.insertion_time += stats_clock() - t;
+            }
+            if (mem_error == -1) {
+                printf("Memory exhausted while creating new child node. Search is terminated...\n");
+                free(candidates);
+                return NULL;
+            }
+            compact_node(current_node);
+        }
+
+        // The candidates make the next level, best first.
+        double t = stats_clock();
+        qsort(candidates, count, sizeof(struct tree_node*), compare_beam);
+        level_count = count;
+        for (i = 0; i < level_count; i++) {
+            if (add_frontier_back(candidates[i]) < 0) {
+                printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
+                free(candidates);
+                return NULL;
+            }
+        }
+        stats.insertion_time += stats_clock() - t;
+    }
+
+    free(candidates);
+    return NULL;
+}
+
+// Returns a lower bound on the moves left to solve a board: every card not at the
+// foundations has to be moved there (or the tighter bound of the pattern database).
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Number of moves
+int moves_lower_bound(struct board *board)
+{
+    if (pdb_table != NULL) {
+        return pdb_cost(board);
+    }
+
+    return cards_left(board);
+}
+
+// Evaluates the frontier again after the weight of the heuristic changed, dropping
+// the nodes that cannot lead to a solution shorter than the incumbent's.
+// Inputs:
+//      int incumbent: Length of the best solution found so far
+void reweigh_frontier(int incumbent)
+{
+    int count = frontier_heap.count;
+    struct tree_node *node;
+
+    // The heap is rebuilt by inserting its nodes again, one after the other.
+    frontier_heap.count = 0;
+    for (int i = 0; i < count; i++) {
+        node = frontier_heap.nodes[i];
+        if (node->g + moves_lower_bound(node->board) >= incumbent) {
+            node->heap_index = -1;
+            count_frontier(-1);
+            continue;
+        }
+        node->f = astar_f(node->g, node->h);
+        heap_place(node, frontier_heap.count++);
+        heap_update(node);
+    }
+}
+
+// Returns the worker owning a board. The upper half of the hash is used, since
+// the transposition tables index their slots with the lower one.
+// Inputs:
+//      unsigned long long hash: The hash of the board
+// Output:
+//      int --> Index of the worker
+int hda_owner(unsigned long long hash)
+{
+    return (int) ((hash >> 32) % threads);
+}
+
+// This function sends a node to the inbox of the worker owning its board.
+// Inputs:
+//      struct hda_worker *worker: The owner of the node's board
+//      struct tree_node *node: A new search-tree node
+// Output:
+//      0 --> The node has been sent successfully
+//     -1 --> Memory problem when allocating the message
+int hda_send(struct hda_worker *worker, struct tree_node *node)
+{
+    struct frontier_node *message = (struct frontier_node*) pool_alloc(&frontier_pool);
+    if (message == NULL) {
+        return -1;
+    }
+    message->n = node;
+
+    // Counted before it is pushed, so the search cannot look finished meanwhile.
+    atomic_fetch_add(&hda_active, 1);
+    message->next = atomic_load_explicit(&worker->inbox, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&worker->inbox, &message->next, message,
+                                                  memory_order_release, memory_order_relaxed));
+
+    return 0;
+}
+
+// This function takes all the nodes of a worker's inbox and adds the new ones to
+// its frontier.
+// Inputs:
+//      struct hda_worker *self: The worker
+// Output:
+//      int --> Number of nodes received
+int hda_receive(struct hda_worker *self)
+{
+    struct frontier_node *message = atomic_exchange_explicit(&self->inbox, NULL, memory_order_acquire);
+    int count = 0;
+    while (message != NULL) {
+        struct frontier_node *next = message->next;
+        struct tree_node *node = admit_child(message->n, hda_method);
+        double t = stats_clock();
+        if (node != NULL && add_frontier_in_order(node) < 0) {
+            mem_error = -1;
+        }
+        stats.insertion_time += stats_clock() - t;
+        pool_free(&frontier_pool, message);
+        message = next;
+        count++;
+    }
+
+    return count;
+}
+
+// This function expands a node in the parallel search. The children owned by the
+// worker are added to its frontier, the other ones are sent to their owners.
+// Inputs:
+//      struct hda_worker *self: The worker
+//      struct tree_node *current_node: A node popped from the worker's frontier
+void hda_expand(struct hda_worker *self, struct tree_node *current_node)
+{
+    struct move_record moves[MAX_CHILDREN];
+    double t = stats_clock();
+    int moves_count = generate_moves(current_node->board, moves);
+    moves_count += generate_sequence_moves(current_node->board, moves + moves_count);
+    stats.move_time += stats_clock() - t;
+    for (int i = 0; i < moves_count; i++) {
+        if (redundant_child(current_node, &moves[i])) {
+            continue;
+        }
+        t = stats_clock();
+        struct tree_node *child = apply_move(current_node, moves[i].move, moves[i].from, moves[i].to);
+        stats.move_time += stats_clock() - t;
+        if (child == NULL) {
+            return;
+        }
+        if (discard_dead_end(child)) {
+            continue;
+        }
+
+        int owner = hda_owner(child->board->hash);
+        if (owner != self->id) {
+            if (hda_send(&hda_workers[owner], child) < 0) {
+                mem_error = -1;
+                return;
+            }
+        } else if ((child = admit_child(child, hda_method)) != NULL) {
+            t = stats_clock();
+            if (add_frontier_in_order(child) < 0) {
+                mem_error = -1;
+            }
+            stats.insertion_time += stats_clock() - t;
+        }
+        if (mem_error == -1) {
+            return;
+        }
+    }
+}
+
+// The main loop of a worker of the parallel search. A worker without nodes to
+// expand turns idle and leaves hda_active; the search is over when no worker is
+// busy and no node is on its way (hda_active is zero), or when a worker finds a
+// solution, runs out of memory or time. An idle worker expands nothing, so it checks
+// the budgets every IDLE_POLL_SECS instead.
+// Inputs:
+//      void *arg: The worker (struct hda_worker*)
+// Output:
+//      NULL
+void *hda_worker_main(void *arg)
+{
+    struct hda_worker *self = (struct hda_worker*) arg;
+    struct tree_node *current_node;
+    struct tree_node *expected = NULL;
+    int idle = 0;
+    double next_idle_poll = 0;
+
+    N = hda_n;
+    search_deadline = hda_start + time_limit;
+    budget_share = threads;
+    if (hda_owner(hda_puzzle->hash) == self->id) {
+        initialize_search(hda_puzzle, hda_method);
+    } else if (init_hash_table(&visited, 1024) < 0) {
+        mem_error = -1;
+    }
+
+    while (mem_error != -1 && !atomic_load_explicit(&hda_stop, memory_order_relaxed)) {
+        if (stats.expanded >= next_poll && budget_exceeded()) {
+            atomic_store(&hda_stop, 1);
+            break;
+        }
+
+        if (atomic_load_explicit(&self->inbox, memory_order_relaxed) != NULL) {
+            if (idle) {
+                atomic_fetch_add(&hda_active, 1);
+                idle = 0;
+            }
+            atomic_fetch_sub(&hda_active, hda_receive(self));
+            continue;
+        }
+
+        if ((current_node = pop_frontier(hda_method)) == NULL) {
+            if (!idle) {
+                atomic_fetch_sub(&hda_active, 1);
+                idle = 1;
+            }
+            if (atomic_load(&hda_active) == 0) {
+                break;
+            }
+            double now = wall_clock();
+            if (now >= next_idle_poll) {
+                if (budget_exceeded()) {
+                    atomic_store(&hda_stop, 1);
+                    break;
+                }
+                next_idle_poll = now + IDLE_POLL_SECS;
+            }
+            sched_yield();
+            continue;
+        }
+
+        // Check if its a solution
+        if (is_solution(current_node->board)) {
+            atomic_compare_exchange_strong(&hda_solution, &expected, current_node);
+            atomic_store(&hda_stop, 1);
+            break;
+        }
+
+        hda_expand(self, current_node);
+        stats.expanded++;
+    }
+
+    if (mem_error == -1 && atomic_exchange(&hda_stop, 1) == 0) {
+        printf("Memory exhausted while creating new child node. Search is terminated...\n");
+    }
+
+    // The nodes are kept for extract_solution, the rest is released.
+    self->pools[0] = tree_pool;
+    self->pools[1] = frontier_pool;
+    self->pools[2] = board_pool;
+    self->mem_error = mem_error;
+    self->stop_reason = stop_reason;
+    self->stats = stats;
+    free_hash_table(&visited);
+    free(frontier_heap.nodes);
+
+    return NULL;
+}
+
+// This function implements the hash-distributed parallel version of best-first
+// search and A* (HDA*), with a worker thread per --threads. Nodes may be freed by
+// another worker than the one that allocated them, so all pools are released
+// together by release_search.
+// Inputs:
+//      struct board *puzzle: The puzzle.
+//      int method: Execution algorithm (best or astar).
+// Output:
+//      NULL --> The problem cannot be solved
+//      struct tree_node* --> A pointer to a search-tree leaf node that corresponds to a solution.
+struct tree_node *parallel_search(struct board *puzzle, int method)
+{
+    int started;
+
+    hda_workers = (struct hda_worker*) calloc(threads, sizeof(struct hda_worker));
+    if (hda_workers == NULL) {
+        mem_error = -1;
+        return NULL;
+    }
+    hda_puzzle = puzzle;
+    hda_method = method;
+    hda_n = N;
+    hda_start = wall_clock();
+    atomic_store(&hda_active, threads);
+    atomic_store(&hda_stop, 0);
+    atomic_store(&hda_solution, NULL);
+
+    // Every inbox is ready before the first worker starts sending nodes.
+    for (int i = 0; i < threads; i++) {
+        hda_workers[i].id = i;
+        atomic_init(&hda_workers[i].inbox, NULL);
+    }
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&hda_workers[started].thread, NULL, hda_worker_main, &hda_workers[started]) != 0) {
+            printf("Cannot start worker thread %d.\n", started);
+            atomic_store(&hda_stop, 1);
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(hda_workers[i].thread, NULL);
+        if (hda_workers[i].mem_error == -1) {
+            mem_error = -1;
+        }
+        if (stop_reason == STOP_NONE) {
+            stop_reason = hda_workers[i].stop_reason;
+        }
+        add_stats(&hda_workers[i].stats);
+    }
+
+    if (started < threads || mem_error == -1) {
+        return NULL;
+    }
+
+    return atomic_load(&hda_solution);
+}
+
+// The IDA* estimate of the cost of solving a board: how far the heuristic score of
+// the board is from the score of a solved board, or with a pattern database the
+// moves it bounds.
+// Inputs:
+//      struct board *board: A board
+// Output:
+//      int --> Estimated cost, in heuristic units
+int ida_cost_to_go(struct board *board)
+{
+    if (pdb_table != NULL) {
+        return IDA_MOVE_COST * pdb_cost(board);
+    }
+
+    return 10 * 4 * N - 5 * 8 - 4 - heuristic(board);
+}
+
+// The recursive part of IDA*: a depth-first search below the current path, cut off
+// at boards whose f = g * IDA_MOVE_COST + ida_cost_to_go exceeds the bound.
+// Moves are made and undone on the single board. A board already on the current
+// path is skipped.
+// Inputs:
+//      struct board *board: The board at the end of the current path
+//      int g: Length of the current path
+//      int bound: The f bound of this iteration
+//      int *next_bound: Smallest f met above the bound
+// Output:
+//      1 --> Solution found, the path holds it
+//      0 --> No solution within the bound
+//     -1 --> Budget exceeded or memory problem
+int ida_dfs(struct board *board, int g, int bound, int *next_bound)
+{
+    int f = g * IDA_MOVE_COST + ida_cost_to_go(board);
+    if (f > bound) {
+        if (f < *next_bound) {
+            *next_bound = f;
+        }
+        return 0;
+    }
+    if (is_solution(board)) {
+        solution_length = g;
+        return 1;
+    }
+    // Checked here rather than on every child: most children are cut by the bound.
+    if (dead_end(board)) {
+        stats.dead_ends++;
+        return 0;
+    }
+
+    if (++stats.expanded >= next_poll && budget_exceeded()) {
+        return -1;
+    }
+    if (g + 1 >= ida_capacity) {
+        int capacity = 2 * ida_capacity;
+        struct move_record *moves = (struct move_record*) realloc(ida_moves, capacity * sizeof(struct move_record));
+        unsigned long long *hashes = (unsigned long long*) realloc(ida_hashes, capacity * sizeof(unsigned long long));
+        if (moves != NULL) {
+            ida_moves = moves;
+        }
+        if (hashes != NULL) {
+            ida_hashes = hashes;
         }
-        if (node->board[i][node->tops[i]].value == 0) {
-            create_child(node, foundation, 0, method, i, 0);
-            return complete_solution(node->children[0], method);
+        if (moves == NULL || hashes == NULL) {
+            mem_error = -1;
+            return -1;
+        }
+        ida_capacity = capacity;
+    }
+
+    struct move_record moves[MAX_CHILDREN];
+    double t = stats_clock();
+    int moves_count = generate_moves(board, moves);
+    stats.move_time += stats_clock() - t;
+    for (int i = 0; i < moves_count; i++) {
+        if (g > 0 && redundant_move(&ida_moves[g - 1], 1, &moves[i])) {
+            stats.redundant++;
+            continue;
         }
-        for (int j = 12; j < 16; j++) {
-            if ((node->board[i][node->tops[i]].suit != node->board[j][node->tops[j]].suit)
-                || (node->board[i][node->tops[i]].value != node->board[j][node->tops[j]].value + 1)) {
-               continue; 
+        make_move(board, &moves[i]);
+        stats.generated++;
+
+        int j;
+        for (j = 0; j <= g && ida_hashes[j] != board->hash; j++);
+        if (j > g) {
+            ida_moves[g] = moves[i];
+            ida_hashes[g + 1] = board->hash;
+            count_frontier(1);
+            int err = ida_dfs(board, g + 1, bound, next_bound);
+            if (err != 0) {
+                return err;
             }
-            create_child(node, foundation, 0, method, i, j);
-            return complete_solution(node->children[0], method);
+            count_frontier(-1);
+        } else {
+            stats.duplicates++;
         }
+
+        unmake_move(board, &moves[i]);
     }
 
-    return node;
+    return 0;
 }
 
-// This function implements at the higest level the search algorithms.
-// The various search algorithms differ only in the way the insert
-// new nodes into the frontier, so most of the code is commmon for all algorithms.
+// This function implements iterative-deepening A*: depth-first searches with an
+// increasing bound on f, each one starting over from the root. Memory stays
+// proportional to the solution length, at the cost of visiting boards again.
+// The solution is stored in the solution tables.
 // Inputs:
-//      int method: Execution algorithm.
+//      struct board *puzzle: The puzzle.
 // Output:
-//      NULL --> The problem cannot be solved
-//      struct tree_node* --> A pointer to a search-tree leaf node that corresponds to a solution.
-struct tree_node *search(int method)
+//      1 --> Solution found
+//      0 --> The problem cannot be solved (or the search was interrupted)
+int ida_search(struct board *puzzle)
 {
-    clock_t t;
-    int i, err;
-    struct frontier_node *current_node;
+    struct board board = *puzzle;
+    int bound = ida_cost_to_go(&board);
+    int next_bound, err;
 
-    while (frontier_head != NULL) {
-        t = clock();
-        if ((t - t1) > (CLOCKS_PER_SEC * TIMEOUT)) {
-            printf("Timeout\n");
-            return NULL;
+    ida_capacity = 256;
+    ida_moves = (struct move_record*) malloc(ida_capacity * sizeof(struct move_record));
+    ida_hashes = (unsigned long long*) malloc(ida_capacity * sizeof(unsigned long long));
+    if (ida_moves == NULL || ida_hashes == NULL) {
+        mem_error = -1;
+        return 0;
+    }
+    ida_hashes[0] = board.hash;
+
+    do {
+        next_bound = INT_MAX;
+        err = ida_dfs(&board, 0, bound, &next_bound);
+        bound = next_bound;
+    } while (err == 0 && next_bound != INT_MAX);
+
+    if (err == 1) {
+        solution = (int*)malloc(solution_length*sizeof(int));
+        sol_moved0 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+        sol_moved1 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+        if ((solution == NULL) || (sol_moved0 == NULL) || (sol_moved1 == NULL)) {
+            mem_error = -1;
+        } else {
+            for (int i = 0; i < solution_length; i++) {
+                solution[i] = ida_moves[i].move;
+                sol_moved0[i] = ida_moves[i].moved0;
+                sol_moved1[i] = ida_moves[i].moved1;
+            }
         }
+    }
 
-        // Extract the first node from the frontier.
-        current_node = frontier_head;
+    free(ida_moves);
+    free(ida_hashes);
 
-        // Check if its a solution
-        int count = 0;
-        for (i = 12; i < 16; i++) {
-            if (current_node->n->tops[i] == -1) {
-                continue;
+    return err == 1;
+}
+
+// This function allocates an empty path set.
+// Inputs:
+//      struct path_set *set: The set to initialize
+//      unsigned long size: Number of slots (a power of two)
+// Output:
+//      0 --> The set has been allocated successfully
+//     -1 --> Memory problem when allocating the set
+int init_path_set(struct path_set *set, unsigned long size)
+{
+    set->keys = (unsigned long long*) malloc(size * sizeof(unsigned long long));
+    set->used = (unsigned char*) calloc(size, sizeof(unsigned char));
+    if (set->keys == NULL || set->used == NULL) {
+        free(set->keys);
+        free(set->used);
+        return -1;
+    }
+    set->size = size;
+    set->count = 0;
+
+    return 0;
+}
+
+// This function releases a path set.
+// Inputs:
+//      struct path_set *set: The set to release
+void free_path_set(struct path_set *set)
+{
+    free(set->keys);
+    free(set->used);
+    set->keys = NULL;
+    set->used = NULL;
+}
+
+// Returns the slot of a path set holding a hash, or the empty slot where it would be stored.
+// Inputs:
+//      struct path_set *set: A path set
+//      unsigned long long hash: A board hash
+// Output:
+//      unsigned long --> Slot index
+unsigned long path_slot(struct path_set *set, unsigned long long hash)
+{
+    unsigned long mask = set->size - 1;
+    unsigned long i = hash & mask;
+    while (set->used[i] && set->keys[i] != hash) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+// This function adds a hash to a path set, doubling its slots when half full.
+// Inputs:
+//      struct path_set *set: A path set
+//      unsigned long long hash: A board hash not in the set
+// Output:
+//      0 --> The hash has been added successfully
+//     -1 --> Memory problem when growing the set
+int path_add(struct path_set *set, unsigned long long hash)
+{
+    if (2 * (set->count + 1) > set->size) {
+        struct path_set grown;
+        if (init_path_set(&grown, 2 * set->size) < 0) {
+            return -1;
+        }
+        for (unsigned long i = 0; i < set->size; i++) {
+            if (set->used[i]) {
+                unsigned long j = path_slot(&grown, set->keys[i]);
+                grown.keys[j] = set->keys[i];
+                grown.used[j] = 1;
+            }
+        }
+        grown.count = set->count;
+        free_path_set(set);
+        *set = grown;
+    }
+
+    unsigned long i = path_slot(set, hash);
+    set->keys[i] = hash;
+    set->used[i] = 1;
+    set->count++;
+
+    return 0;
+}
+
+// This function removes a hash from a path set. The following hashes of the probe
+// sequence are shifted back, so no deleted markers are needed.
+// Inputs:
+//      struct path_set *set: A path set
+//      unsigned long long hash: A board hash in the set
+void path_remove(struct path_set *set, unsigned long long hash)
+{
+    unsigned long mask = set->size - 1;
+    unsigned long i = path_slot(set, hash);
+    unsigned long j = i;
+    set->used[i] = 0;
+    set->count--;
+
+    while (1) {
+        j = (j + 1) & mask;
+        if (!set->used[j]) {
+            return;
+        }
+        // The hash at j may move to i only if i lies between its home slot and j.
+        unsigned long home = set->keys[j] & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            set->keys[i] = set->keys[j];
+            set->used[i] = 1;
+            set->used[j] = 0;
+            i = j;
+        }
+    }
+}
+
+// This function implements the depth-first search without a search tree: moves are
+// made and undone on a single board, and generated one at a time when the search
+// comes back to a board. Only the current path is stored (its moves, the move
+// iterators of its boards and a set of its board hashes for loop detection), so
+// memory grows with the depth only. The solution is stored in the solution tables.
+// Inputs:
+//      struct board *puzzle: The puzzle.
+// Output:
+//      1 --> Solution found
+//      0 --> The problem cannot be solved (or the search was interrupted)
+int dfs_search(struct board *puzzle)
+{
+    struct board board = *puzzle;
+    struct move_record *moves;       // Moves of the current path.
+    struct move_iterator *iterators; // Move iterators of the boards of the current path.
+    struct path_set on_path;         // Hashes of the boards of the current path.
+    struct move_record m;
+    int capacity = 256;
+    int level = 0;
+    int found = 0;
+
+    moves = (struct move_record*) malloc(capacity * sizeof(struct move_record));
+    iterators = (struct move_iterator*) malloc(capacity * sizeof(struct move_iterator));
+    if (moves == NULL || iterators == NULL || init_path_set(&on_path, 2 * capacity) < 0) {
+        free(moves);
+        free(iterators);
+        mem_error = -1;
+        return 0;
+    }
+    path_add(&on_path, board.hash);
+    iterators[0] = (struct move_iterator) {11, 7, 0};
+    found = is_solution(&board);
+
+    while (!found) {
+        if (stats.expanded >= next_poll && budget_exceeded()) {
+            break;
+        }
+
+        double t = stats_clock();
+        int more = next_move(&board, &iterators[level], &m);
+        stats.move_time += stats_clock() - t;
+        if (!more) {
+            // No moves left: backtrack.
+            if (level == 0) {
+                break;
+            }
+            path_remove(&on_path, board.hash);
+            level--;
+            count_frontier(-1);
+            unmake_move(&board, &moves[level]);
+            continue;
+        }
+
+        // Depth keeps both orders of independent moves: pruning one only sends it down another branch.
+        if (level > 0 && redundant_move(&moves[level - 1], 0, &m)) {
+            stats.redundant++;
+            continue;
+        }
+        make_move(&board, &m);
+        stats.generated++;
+        if (on_path.used[path_slot(&on_path, board.hash)]) {
+            // Loop detection.
+            stats.duplicates++;
+            unmake_move(&board, &m);
+            continue;
+        }
+        if (dead_end(&board)) {
+            stats.dead_ends++;
+            unmake_move(&board, &m);
+            continue;
+        }
+
+        if (level + 1 == capacity) {
+            capacity *= 2;
+            struct move_record *new_moves = (struct move_record*) realloc(moves, capacity * sizeof(struct move_record));
+            struct move_iterator *new_iterators = (struct move_iterator*) realloc(iterators, capacity * sizeof(struct move_iterator));
+            if (new_moves != NULL) {
+                moves = new_moves;
+            }
+            if (new_iterators != NULL) {
+                iterators = new_iterators;
+            }
+            if (new_moves == NULL || new_iterators == NULL) {
+                mem_error = -1;
+                break;
+            }
+        }
+        if (path_add(&on_path, board.hash) < 0) {
+            mem_error = -1;
+            break;
+        }
+        moves[level] = m;
+        level++;
+        stats.expanded++;
+        count_frontier(1);
+        iterators[level] = (struct move_iterator) {11, 7, 0};
+        found = is_solution(&board);
+    }
+
+    if (found) {
+        solution_length = level;
+        solution = (int*)malloc(solution_length*sizeof(int));
+        sol_moved0 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+        sol_moved1 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+        if ((solution == NULL) || (sol_moved0 == NULL) || (sol_moved1 == NULL)) {
+            mem_error = -1;
+            found = 0;
+        } else {
+            for (int i = 0; i < solution_length; i++) {
+                solution[i] = moves[i].move;
+                sol_moved0[i] = moves[i].moved0;
+                sol_moved1[i] = moves[i].moved1;
+            }
+        }
+    }
+
+    free(moves);
+    free(iterators);
+    free_path_set(&on_path);
+
+    return found;
+}
+
+// Writes the canonical form of a board as the key of an external record: the stacked
+// cards (padded with NO_CARD to 4N), the stack lengths, the freecells and the foundations.
+// Inputs:
+//      struct board *board: A board in canonical form
+//      unsigned char *key: The key (external_key bytes)
+void encode_board(struct board *board, unsigned char *key)
+{
+    memcpy(key, board->cards, 4 * N);
+    memcpy(key + 4 * N, board->len, 8);
+    memcpy(key + 4 * N + 8, board->freecells, 4);
+    memcpy(key + 4 * N + 12, board->foundations, 4);
+}
+
+// Rebuilds a board from the key of an external record.
+// Inputs:
+//      unsigned char *key: The key
+//      struct board *board: The board
+void decode_board(unsigned char *key, struct board *board)
+{
+    memset(board->cards, NO_CARD, MAX_CARDS);
+    memcpy(board->cards, key, 4 * N);
+    memcpy(board->len, key + 4 * N, 8);
+    memcpy(board->freecells, key + 4 * N + 8, 4);
+    memcpy(board->foundations, key + 4 * N + 12, 4);
+    board->hash = 0;
+}
+
+// Orders external records by key.
+// Inputs:
+//      const void *a: An external record
+//      const void *b: Another external record
+// Output:
+//      <0, 0, >0 --> Record a comes before, with, or after record b
+int compare_records(const void *a, const void *b)
+{
+    return memcmp(a, b, external_key);
+}
+
+// Undoes the move recorded in an external record, by card: the card is taken back
+// from where it went and put back on the card it came from (or in a freecell, or on
+// an empty stack).
+// Inputs:
+//      struct board *board: The board the move led to
+//      unsigned char *record: The external record of the board
+void undo_external_move(struct board *board, unsigned char *record)
+{
+    unsigned char *m = record + external_key;
+    unsigned char c = m[1];
+    int i;
+
+    if (m[0] == foundation) {
+        board->foundations[card_suit(c)]--;
+    } else {
+        pop_card(board, find_card(board, c));
+    }
+
+    if (m[3] == FROM_FREECELL) {
+        for (i = 0; i < 4 && board->freecells[i] != NO_CARD; i++);
+        board->freecells[i] = c;
+    } else if (m[3] == NO_CARD) {
+        for (i = 0; i < 8 && board->len[i] != 0; i++);
+        push_card(board, i, c);
+    } else {
+        push_card(board, find_card(board, m[3]), c);
+    }
+}
+
+// Returns the name of a file of the external search.
+// Inputs:
+//      char *name: Space for the name (PATH_MAX bytes)
+//      int id: Number of the search
+//      char *kind: "layer" or "run"
+//      int i: Number of the layer or run
+// Output:
+//      char* --> The name
+char *external_file(char *name, int id, char *kind, int i)
+{
+    snprintf(name, PATH_MAX, "%s/freecell_%d_%d_%s_%d.bin", external_dir, (int) getpid(), id, kind, i);
+
+    return name;
+}
+
+// Looks a key up in a layer file, by binary search over its records.
+// Inputs:
+//      FILE *fin: A layer file
+//      unsigned char *key: The key
+//      unsigned char *record: Space for the record found
+// Output:
+//      1 --> Found
+//      0 --> Not found
+int find_record(FILE *fin, unsigned char *key, unsigned char *record)
+{
+    fseek(fin, 0, SEEK_END);
+    long low = 0, high = ftell(fin) / external_record - 1;
+    while (low <= high) {
+        long middle = (low + high) / 2;
+        fseek(fin, middle * external_record, SEEK_SET);
+        if (fread(record, external_record, 1, fin) != 1) {
+            return 0;
+        }
+        int c = memcmp(record, key, external_key);
+        if (c == 0) {
+            return 1;
+        } else if (c < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return 0;
+}
+
+// Sorts the records of the buffer and writes them, without duplicates, as a run file.
+// Inputs:
+//      unsigned char *buffer: The records
+//      long count: Number of records
+//      char *name: The name of the run file
+// Output:
+//      0 --> The run has been written
+//     -1 --> Cannot write the file
+int write_run(unsigned char *buffer, long count, char *name)
+{
+    FILE *fout = fopen(name, "wb");
+    if (fout == NULL) {
+        return -1;
+    }
+
+    double t = stats_clock();
+    qsort(buffer, count, external_record, compare_records);
+    stats.insertion_time += stats_clock() - t;
+    for (long i = 0; i < count; i++) {
+        unsigned char *record = buffer + i * external_record;
+        if (i > 0 && memcmp(record - external_record, record, external_key) == 0) {
+            stats.duplicates++;
+            continue;
+        }
+        fwrite(record, external_record, 1, fout);
+    }
+
+    return fclose(fout) == 0 ? 0 : -1;
+}
+
+// Reads the next record of a sorted file, unless the file is done.
+// Inputs:
+//      FILE *fin: A sorted file (NULL if none)
+//      unsigned char *record: Space for the record
+// Output:
+//      1 --> A record was read
+//      0 --> No more records
+int next_record(FILE *fin, unsigned char *record)
+{
+    return fin != NULL && fread(record, external_record, 1, fin) == 1;
+}
+
+// Merges the runs of a new layer into its layer file, dropping the boards found more
+// than once and those of the two previous layers (delayed duplicate detection). All
+// the files are sorted, so they are read once, side by side.
+// Inputs:
+//      int id: Number of the search
+//      int runs: Number of runs
+//      FILE *previous: The previous layer file
+//      FILE *before: The layer file before it (NULL if none)
+//      FILE *fout: The new layer file
+// Output:
+//      long --> Number of boards in the new layer (-1 if a run cannot be read)
+long merge_runs(int id, int runs, FILE *previous, FILE *before, FILE *fout)
+{
+    char name[PATH_MAX];
+    FILE **fin = (FILE**) calloc(runs, sizeof(FILE*));
+    unsigned char *heads = (unsigned char*) malloc((size_t) (runs + 3) * external_record);
+    unsigned char *last = heads + (size_t) runs * external_record;
+    unsigned char *old1 = last + external_record;
+    unsigned char *old2 = old1 + external_record;
+    long count = 0;
+    int has_last = 0;
+    int i, smallest;
+
+    if (fin == NULL || heads == NULL) {
+        free(fin);
+        free(heads);
+        return -1;
+    }
+    for (i = 0; i < runs; i++) {
+        fin[i] = fopen(external_file(name, id, "run", i), "rb");
+        if (fin[i] == NULL || !next_record(fin[i], heads + (size_t) i * external_record)) {
+            if (fin[i] != NULL) {
+                fclose(fin[i]);
             }
-            if (current_node->n->board[i][current_node->n->tops[i]].value == N - 1) {
-                count++;
+            fin[i] = NULL;
+        }
+    }
+    rewind(previous);
+    int more1 = next_record(previous, old1);
+    if (before != NULL) {
+        rewind(before);
+    }
+    int more2 = next_record(before, old2);
+
+    while (1) {
+        // The smallest head of the runs.
+        smallest = -1;
+        for (i = 0; i < runs; i++) {
+            if (fin[i] != NULL && (smallest < 0 || memcmp(heads + (size_t) i * external_record,
+                                                      heads + (size_t) smallest * external_record, external_key) < 0)) {
+                smallest = i;
             }
         }
-        if (count == 3) {
-            return complete_solution(current_node->n, method);
-        }        
+        if (smallest < 0) {
+            break;
+        }
+        unsigned char *record = heads + (size_t) smallest * external_record;
+
+        while (more1 && memcmp(old1, record, external_key) < 0) {
+            more1 = next_record(previous, old1);
+        }
+        while (more2 && memcmp(old2, record, external_key) < 0) {
+            more2 = next_record(before, old2);
+        }
+        if ((has_last && memcmp(last, record, external_key) == 0)
+            || (more1 && memcmp(old1, record, external_key) == 0)
+            || (more2 && memcmp(old2, record, external_key) == 0)) {
+            stats.duplicates++;
+        } else {
+            fwrite(record, external_record, 1, fout);
+            memcpy(last, record, external_record);
+            has_last = 1;
+            count++;
+        }
+
+        if (!next_record(fin[smallest], record)) {
+            fclose(fin[smallest]);
+            fin[smallest] = NULL;
+            remove(external_file(name, id, "run", smallest));
+        }
+    }
+
+    free(fin);
+    free(heads);
+
+    return count;
+}
+
+// Rebuilds the solution from the record of the board that reached it, going back
+// layer by layer: the recorded move is undone, and the parent board found in the
+// previous layer file holds the move before.
+// Inputs:
+//      int id: Number of the search
+//      int level: The layer of the record
+//      unsigned char *record: The record (it is overwritten)
+//      unsigned char *last_move: The move info of the solution's last step
+// Output:
+//      1 --> The solution is in the solution tables
+//      0 --> Memory or file problem
+int external_solution(int id, int level, unsigned char *record, unsigned char *last_move)
+{
+    char name[PATH_MAX];
+    unsigned char key[MAX_CARDS + 16];
+    struct board board;
+
+    solution_length = level + 1;
+    solution = (int*)malloc(solution_length*sizeof(int));
+    sol_moved0 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+    sol_moved1 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+    if ((solution == NULL) || (sol_moved0 == NULL) || (sol_moved1 == NULL)) {
+        mem_error = -1;
+        return 0;
+    }
+    solution[level] = last_move[0];
+    sol_moved0[level] = last_move[1];
+    sol_moved1[level] = last_move[2];
+
+    for (int i = level; i > 0; i--) {
+        unsigned char *m = record + external_key;
+        solution[i - 1] = m[0];
+        sol_moved0[i - 1] = m[1];
+        sol_moved1[i - 1] = m[2];
+
+        decode_board(record, &board);
+        undo_external_move(&board, record);
+        canonicalize_board(&board);
+        encode_board(&board, key);
+        FILE *fin = fopen(external_file(name, id, "layer", i - 1), "rb");
+        int found = fin != NULL && find_record(fin, key, record);
+        if (fin != NULL) {
+            fclose(fin);
+        }
+        if (!found) {
+            printf("Parent board missing from %s.\n", name);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// This function implements breadth-first search in external memory. Every layer of
+// the search is a file of records, sorted by key: the canonical board, followed by the
+// move that led to it (kind, moved card, card it landed on, card it came from). The
+// boards of a layer are expanded one after the other, their children sorted in memory
+// in runs, and the runs merged into the next layer file (see merge_runs). Memory stays
+// at the run buffer, whatever the size of the layers, and the solution is optimal.
+// Moves to the foundations cannot be undone, so a board older than the two previous
+// layers may come back: it is then expanded again, which costs time, not correctness.
+// The moves redundant after the move of a record are not generated (see redundant_move).
+// Inputs:
+//      struct board *puzzle: The puzzle.
+// Output:
+//      1 --> Solution found
+//      0 --> The problem cannot be solved (or the search was interrupted, or failed on
+//            its files: stop_reason tells why)
+int external_search(struct board *puzzle)
+{
+    char name[PATH_MAX];
+    struct board board, child;
+    struct move_record moves[MAX_CHILDREN];
+    unsigned char record[MAX_CARDS + 20];
+    FILE *layers[3] = {NULL, NULL, NULL}; // The current, previous and next layer files.
+    FILE *before = NULL;                  // The layer file before the previous one.
+    int id = atomic_fetch_add(&external_count, 1);
+    int level = 0, runs = 0, found = 0, failed = 0;
+    long size = 1, count;
+
+    external_key = 4 * N + 16;
+    external_record = external_key + 4;
+    size_t buffer_size = memory_limit > 0 && memory_limit < EXTERNAL_BUFFER ? memory_limit : EXTERNAL_BUFFER;
+    long capacity = buffer_size / external_record;
+    unsigned char *buffer = (unsigned char*) malloc(capacity * external_record);
+    if (buffer == NULL) {
+        mem_error = -1;
+        return 0;
+    }
+    stats.bytes_allocated += capacity * external_record;
 
-        // Find the children of the frontier node.
-        find_children(current_node->n, method);
-        if (mem_error == -1) {
-            printf("Memory exhausted while creating new child node. Search is terminated...\n");
-            return NULL;
-        }
+    // Layer 0 holds the puzzle alone.
+    board = *puzzle;
+    canonicalize_board(&board);
+    encode_board(&board, record);
+    memset(record + external_key, NO_CARD, 4);
+    layers[0] = fopen(external_file(name, id, "layer", 0), "w+b");
+    if (layers[0] == NULL || fwrite(record, external_record, 1, layers[0]) != 1) {
+        printf("Cannot write %s.\n", name);
+        stop_reason = STOP_DISK;
+        failed = 1;
+    }
+    if (is_solution(&board)) {
+        found = 1;
+    }
+    count_frontier(1);
 
-        // Add children to frontier.
-        for (i = 0; i < 20; i++) {
-            if (current_node->n->children[i] == NULL) {
+    for (level = 0; !found && !failed && size > 0; level++) {
+        // Expand the layer, writing its children in sorted runs.
+        long filled = 0;
+        runs = 0;
+        rewind(layers[0]);
+        while (!found && next_record(layers[0], record)) {
+            if (stats.expanded >= next_poll && budget_exceeded()) {
+                failed = 1;
                 break;
             }
-            if (method == depth) {
-                err = add_frontier_front(current_node->n->children[i]);
-            } else if (method == breadth) {
-                err = add_frontier_back(current_node->n->children[i]);
-            } else {
-                err = add_frontier_in_order(current_node->n->children[i]);
+            decode_board(record, &board);
+            double t = stats_clock();
+            int moves_count = generate_moves(&board, moves);
+            stats.move_time += stats_clock() - t;
+            stats.expanded++;
+            unsigned char *r = record + external_key;
+            struct move_record last = {r[0], 0, 0, r[1], r[2], r[3]};
+            for (int i = 0; i < moves_count && !found; i++) {
+                if (level > 0 && redundant_move(&last, 1, &moves[i])) {
+                    stats.redundant++;
+                    continue;
+                }
+                unsigned char *out = buffer + filled * external_record;
+                unsigned char *m = out + external_key;
+                int from = moves[i].from;
+                m[0] = moves[i].move;
+                m[1] = moves[i].moved0;
+                m[2] = moves[i].moved1;
+                m[3] = card_below(&board, from, 1);
+                child = board;
+                execute_move(&child, moves[i].move, from, moves[i].to);
+                canonicalize_board(&child);
+                encode_board(&child, out);
+                stats.generated++;
+                if (is_solution(&child)) {
+                    found = external_solution(id, level, record, m);
+                    if (!found && mem_error != -1) {
+                        stop_reason = STOP_DISK;
+                    }
+                    failed = !found;
+                    break;
+                }
+                if (dead_end(&child)) {
+                    stats.dead_ends++;
+                    continue;
+                }
+                if (++filled == capacity) {
+                    if (write_run(buffer, filled, external_file(name, id, "run", runs++)) < 0) {
+                        printf("Cannot write %s.\n", name);
+                        stop_reason = STOP_DISK;
+                        failed = 1;
+                        break;
+                    }
+                    filled = 0;
+                }
             }
-            if (err < 0) {
-                printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
-                return NULL;
+            if (failed) {
+                break;
             }
         }
+        if (found || failed) {
+            break;
+        }
+        if (filled > 0 && write_run(buffer, filled, external_file(name, id, "run", runs++)) < 0) {
+            printf("Cannot write %s.\n", name);
+            stop_reason = STOP_DISK;
+            break;
+        }
 
-        // Shift frontier head
-        if (current_node->previous != NULL) {
-            // Current node is no longer frontier head, so we link
-            // its previous with its next node.
-            current_node->previous->next = current_node->next;
-        } else {
-            // Node is still frontier head, so we move to next one.
-            frontier_head = current_node->next;
-            if (frontier_head != NULL) {
-                frontier_head->previous = NULL;
-            }
+        // Merge the runs into the next layer.
+        layers[2] = fopen(external_file(name, id, "layer", level + 1), "w+b");
+        if (layers[2] == NULL || (count = merge_runs(id, runs, layers[0], before, layers[2])) < 0) {
+            printf("Cannot write %s.\n", name);
+            stop_reason = STOP_DISK;
+            break;
         }
+        count_frontier(count - size);
+        size = count;
+        if (before != NULL) {
+            fclose(before);
+        }
+        before = layers[0];
+        layers[0] = layers[2];
+        layers[2] = NULL;
+    }
 
-        // Free node.
-        free(current_node);
+    free(buffer);
+    if (before != NULL) {
+        fclose(before);
+    }
+    if (layers[0] != NULL) {
+        fclose(layers[0]);
+    }
+    if (layers[2] != NULL) {
+        fclose(layers[2]);
+    }
+    for (int i = 0; i <= level + 1; i++) {
+        remove(external_file(name, id, "layer", i));
+    }
+    for (int i = 0; i < runs; i++) {
+        remove(external_file(name, id, "run", i));
     }
 
-    return NULL;
+    return found;
+}
+
+// This function releases everything the search allocated: the search tree, the
+// frontier and the transposition table. The solution must be extracted before.
+void release_search()
+{
+    pool_release(&tree_pool);
+    pool_release(&frontier_pool);
+    pool_release(&board_pool);
+    free_hash_table(&visited);
+    free(frontier_heap.nodes);
+    frontier_heap.nodes = NULL;
+    frontier_heap.count = 0;
+    frontier_heap.capacity = 0;
+    frontier_head = NULL;
+    frontier_tail = NULL;
+
+    if (hda_workers != NULL) {
+        for (int i = 0; i < threads; i++) {
+            for (int j = 0; j < 3; j++) {
+                pool_release(&hda_workers[i].pools[j]);
+            }
+        }
+        free(hda_workers);
+        hda_workers = NULL;
+    }
 }
 
 // Giving a (solution) leaf-node of the search tree, this function computes
@@ -916,23 +4166,36 @@ struct tree_node *search(int method)
 void extract_solution(struct tree_node *solution_node)
 {
     struct tree_node *temp_node = solution_node;
-    solution_length = solution_node->g;
+    struct board board, tmp;
+    struct move_record steps[MAX_STEPS];
+
+    // A node's move stands for its single-card steps, followed by the cards it sent to
+    // the foundations, found again by replaying the move on its parent's board.
+    solution_length = 0;
+    for (temp_node = solution_node; temp_node->parent != NULL; temp_node = temp_node->parent) {
+        board = *node_board(temp_node->parent, &tmp);
+        solution_length += replay_move(&board, temp_node, NULL);
+    }
     
     solution = (int*)malloc(solution_length*sizeof(int));
-    sol_moved0 = (struct card*)malloc(solution_length*sizeof(struct card));
-    sol_moved1 = (struct card*)malloc(solution_length*sizeof(struct card));
+    sol_moved0 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
+    sol_moved1 = (unsigned char*)malloc(solution_length*sizeof(unsigned char));
     if ((solution == NULL) || (sol_moved0 == NULL) || (sol_moved1 == NULL)) {
+        printf("Memory exhausted while creating solution path...\n");
         mem_error = -1;
         return;
     }
     temp_node = solution_node;
     int i = solution_length;
     while (temp_node->parent != NULL) {
-        i--;
-        solution[i] = temp_node->move;
-        sol_moved0[i] = temp_node->moved0;
-        if (temp_node->move == 2) {
-            sol_moved1[i] = temp_node->moved1;
+        board = *node_board(temp_node->parent, &tmp);
+        int count = replay_move(&board, temp_node, steps);
+        while (count > 0) {
+            i--;
+            count--;
+            solution[i] = steps[count].move;
+            sol_moved0[i] = steps[count].moved0;
+            sol_moved1[i] = steps[count].moved1;
         }
         temp_node = temp_node->parent;
     }
@@ -941,7 +4204,7 @@ void extract_solution(struct tree_node *solution_node)
 // This function writes the solution into a file
 // Inputs:
 //      char *filename: The name of the file where the solution will be written.
-void write_solution_to_file(char *filename, int solution_length, int *solution, struct card *m0, struct card *m1)
+void write_solution_to_file(char *filename, int solution_length, int *solution, unsigned char *m0, unsigned char *m1)
 {
     FILE *fout = fopen(filename, "w");
     if (fout == NULL) {
@@ -951,92 +4214,610 @@ void write_solution_to_file(char *filename, int solution_length, int *solution,
     }
     fprintf(fout, "K = %d\n", solution_length);
     for (int i = 0; i < solution_length; i++) {
-        if (solution[i] == foundation) {
-            fprintf(fout, "foundation ");
-        } else if (solution[i] == newstack) {
-            fprintf(fout, "newstack ");
-        } else if (solution[i] == stack) {
-            fprintf(fout, "stack ");
-        } else {
-            fprintf(fout, "freecell ");
-        }
+        fprintf(fout, "%s ", move_name(solution[i]));
 
-        if (m0[i].suit == 0) {
-            fprintf(fout, "H");
-        } else if (m0[i].suit == 1) {
-            fprintf(fout, "S");
-        } else if (m0[i].suit == 2) {
-            fprintf(fout, "D");
-        } else {
-            fprintf(fout, "C");
-        }
-        fprintf(fout, "%d ", m0[i].value);
+        print_card(fout, m0[i]);
+        fprintf(fout, " ");
         
         if (solution[i] != stack) {
             fprintf(fout, "\n");
             continue;
         }
 
-        if (m1[i].suit == 0) {
-            fprintf(fout, "H");
-        } else if (m1[i].suit == 1) {
-            fprintf(fout, "S");
-        } else if (m1[i].suit == 2) {
-            fprintf(fout, "D");
-        } else {
-            fprintf(fout, "C");
+        print_card(fout, m1[i]);
+        fprintf(fout, "\n");
+    }
+    fclose(fout);
+}
+
+// Returns the peak resident set size of the process, as reported by Linux.
+// Output:
+//      long --> Peak RSS in KB (-1 if unknown)
+long peak_rss_kb()
+{
+    FILE *fin = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    if (fin == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fin) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fin);
+
+    return kb;
+}
+
+// Returns the outcome of the last search: solved, unsolved, memory (exhausted or
+// over --memory-limit), the budget that stopped it (timeout, node-limit or rss-limit)
+// or disk-error when the external search failed on its files.
+// Inputs:
+//      int found: Whether a solution was found
+char *outcome_name(int found)
+{
+    static char *stopped[] = {"unsolved", "timeout", "node-limit", "rss-limit", "disk-error"};
+
+    if (found) {
+        return "solved";
+    } else if (mem_error == -1) {
+        return "memory";
+    }
+
+    return stopped[stop_reason];
+}
+
+// This function prints the statistics of the search, as text or as a JSON object
+// on a single line (see --stats).
+// Inputs:
+//      int method: Execution algorithm.
+//      int found: Whether a solution was found
+//      double secs: Time spent
+void print_stats(int method, int found, double secs)
+{
+    char *status = outcome_name(found);
+    double other_time = secs - stats.move_time - stats.visited_time - stats.evaluation_time - stats.insertion_time;
+
+    if (stats_format == 1) {
+        printf("Duplicates pruned: %lu\n", stats.duplicates);
+        printf("Boards forgotten: %lu\n", stats.forgotten);
+        printf("Dead ends pruned: %lu\n", stats.dead_ends);
+        printf("Redundant moves pruned: %lu\n", stats.redundant);
+        printf("Max frontier: %lu\n", stats.max_frontier);
+        printf("Bytes allocated: %zu\n", stats.bytes_allocated);
+        printf("Pool allocations: %lu\n", stats.allocations);
+        printf("Time in move generation: %f secs\n", stats.move_time);
+        printf("Time in duplicate detection: %f secs\n", stats.visited_time);
+        printf("Time in evaluation: %f secs\n", stats.evaluation_time);
+        printf("Time in frontier insertion: %f secs\n", stats.insertion_time);
+        printf("Time elsewhere: %f secs\n", other_time);
+        return;
+    }
+
+    printf("{\"method\": \"%s\", \"n\": %d, \"status\": \"%s\", \"solution_length\": %d, ",
+           method_name(method), N, status, found ? solution_length : 0);
+    printf("\"threads\": %d, \"time\": %f, \"nodes_expanded\": %lu, \"nodes_generated\": %lu, ",
+           threads, secs, stats.expanded, stats.generated);
+    printf("\"duplicates_pruned\": %lu, \"boards_forgotten\": %lu, \"max_frontier\": %lu, \"bytes_allocated\": %zu, ",
+           stats.duplicates, stats.forgotten, stats.max_frontier, stats.bytes_allocated);
+    printf("\"dead_ends_pruned\": %lu, \"redundant_moves_pruned\": %lu, \"pool_allocations\": %lu, ",
+           stats.dead_ends, stats.redundant, stats.allocations);
+    printf("\"peak_rss_kb\": %ld, ", peak_rss_kb());
+    printf("\"time_split\": {\"move_generation\": %f, \"duplicate_detection\": %f, \"evaluation\": %f, "
+           "\"frontier_insertion\": %f, \"other\": %f}}\n",
+           stats.move_time, stats.visited_time, stats.evaluation_time, stats.insertion_time, other_time);
+}
+
+// This function releases the solution tables.
+void free_solution()
+{
+    free(solution);
+    free(sol_moved0);
+    free(sol_moved1);
+    solution = NULL;
+    sol_moved0 = NULL;
+    sol_moved1 = NULL;
+}
+
+// This function implements anytime weighted A*. The search starts with the
+// heuristic weighted by --anytime to reach a first solution quickly. Every time
+// a shorter solution is found, it becomes the incumbent: it is stored in the
+// solution tables (and written to anytime_output), the weight is decreased by one
+// down to 1, and the nodes that cannot beat it are pruned. The search goes on
+// until the frontier is empty or a budget stops it, keeping the incumbent.
+// Output:
+//      1 --> Solution found (the best one is in the solution tables)
+//      0 --> No solution found
+int anytime_search()
+{
+    int found = 0;
+    struct tree_node *current_node, *child;
+    struct child_iterator it;
+
+    while ((current_node = pop_frontier(astar)) != NULL) {
+        if (stats.expanded >= next_poll && budget_exceeded()) {
+            break;
+        }
+        if (found && current_node->g + moves_lower_bound(current_node->board) >= solution_length) {
+            continue;
+        }
+
+        if (is_solution(current_node->board)) {
+            if (found && current_node->g >= solution_length) {
+                continue;
+            }
+            free_solution();
+            extract_solution(current_node);
+            if (mem_error == -1) {
+                return 0;
+            }
+            found = 1;
+            if (anytime_output != NULL) {
+                printf("Solution improved: %d steps (weight %d, %f secs)\n", solution_length, search_weight,
+                       wall_clock() - t1);
+                write_solution_to_file(anytime_output, solution_length, solution, sol_moved0, sol_moved1);
+            }
+            if (search_weight > 1) {
+                search_weight--;
+            }
+            reweigh_frontier(solution_length);
+            continue;
+        }
+
+        // Children that cannot beat the incumbent are dropped, most before their board is built.
+        int bound = found ? solution_length : INT_MAX;
+        start_children(current_node, astar, &it);
+        stats.expanded++;
+        while ((child = next_child(current_node, astar, &it, bound)) != NULL) {
+            if (child->g + moves_lower_bound(child->board) >= bound) {
+                // Kept in the transposition table only, its board rebuilt if need be (see node_board).
+                pool_free(&board_pool, child->board);
+                child->board = NULL;
+                continue;
+            }
+            double t = stats_clock();
+            int err = add_frontier_in_order(child);
+            stats.insertion_time += stats_clock() - t;
+            if (err < 0) {
+                printf("Memory exhausted while creating new frontier node. Search is terminated...\n");
+                mem_error = -1;
+                return found;
+            }
+        }
+        if (mem_error == -1) {
+            printf("Memory exhausted while creating new child node. Search is terminated...\n");
+            break;
+        }
+        compact_node(current_node);
+    }
+
+    return found;
+}
+
+// This function solves a puzzle with a search algorithm, storing the solution in the
+// solution tables. Everything else the search allocated is released.
+// Inputs:
+//      struct board *puzzle: The puzzle.
+//      int method: Execution algorithm.
+//      int parallel: 1 to run best and astar on --threads workers, 0 for the serial search.
+// Output:
+//      1 --> Solution found
+//      0 --> No solution found (mem_error and stop_reason tell why)
+int solve_puzzle(struct board *puzzle, int method, int parallel)
+{
+    struct tree_node *solution_node;
+
+    mem_error = 0;
+    stop_reason = STOP_NONE;
+    next_poll = 0;
+    memset(&stats, 0, sizeof(stats));
+    solution_length = 0;
+    search_weight = 0;
+    search_deadline = wall_clock() + time_limit;
+
+    if (method == idastar) {
+        // IDA* needs no search tree.
+        return ida_search(puzzle);
+    } else if (method == depth) {
+        // Neither does the depth-first engine.
+        return dfs_search(puzzle);
+    } else if (method == breadth && external_dir != NULL) {
+        // The external search keeps its layers on disk.
+        return external_search(puzzle);
+    }
+
+    if (method == astar && anytime > 0 && !parallel) {
+        // The anytime search keeps its incumbent in the solution tables.
+        search_weight = anytime;
+        initialize_search(puzzle, method);
+        int found = mem_error != -1 && anytime_search();
+        release_search();
+        return found;
+    }
+
+    if (parallel) {
+        solution_node = parallel_search(puzzle, method);
+    } else if (method == beam) {
+        initialize_search(puzzle, method);
+        solution_node = mem_error != -1 ? beam_search() : NULL;
+    } else {
+        initialize_search(puzzle, method);
+        // The main call.
+        solution_node = mem_error != -1 ? search(method) : NULL;
+    }
+
+    if (solution_node != NULL) {
+        extract_solution(solution_node);
+    }
+    release_search();
+
+    return solution_node != NULL && mem_error != -1;
+}
+
+// This function reads the puzzles of a file into the batch. Every puzzle starts
+// with a line holding its N, followed by the lines of its stacks.
+// Inputs:
+//      char *filename: The name of the file
+// Output:
+//      0 --> Successful read.
+//     -1 --> Unsuccessful read
+int add_batch_file(char *filename)
+{
+    FILE *fin = fopen(filename, "r");
+    if (fin == NULL) {
+        printf("Cannot open file %s.\n", filename);
+        return -1;
+    }
+
+    char *name = strdup(filename);
+    char *buffer = NULL;
+    size_t bufsize = 0;
+    struct batch_puzzle *puzzle = NULL;
+    int index = 0;
+    int stacks = 0;
+    int err = name == NULL ? -1 : 0;
+    while (err == 0 && getline(&buffer, &bufsize, fin) != -1) {
+        char *c = buffer + strspn(buffer, " \t\r\n");
+        if (*c == '\0') {
+            continue;
+        }
+        if (*c < '0' || *c > '9') {
+            // The next stack of the current puzzle.
+            if (puzzle != NULL && stacks < 8) {
+                parse_stack(&puzzle->board, stacks++, buffer);
+            }
+            continue;
+        }
+
+        // A new puzzle.
+        if (batch_count == batch_capacity) {
+            int capacity = batch_capacity > 0 ? 2 * batch_capacity : 64;
+            struct batch_puzzle *puzzles = (struct batch_puzzle*) realloc(batch_puzzles, capacity * sizeof(struct batch_puzzle));
+            if (puzzles == NULL) {
+                err = -1;
+                break;
+            }
+            batch_puzzles = puzzles;
+            batch_capacity = capacity;
+        }
+        puzzle = &batch_puzzles[batch_count++];
+        puzzle->name = name;
+        puzzle->index = ++index;
+        puzzle->n = atoi(c);
+        generate_board(&puzzle->board);
+        stacks = 0;
+    }
+
+    if (index == 0) {
+        free(name);
+    }
+    free(buffer);
+    fclose(fin);
+    if (err < 0) {
+        printf("Memory exhausted while reading %s.\n", filename);
+    }
+
+    return err;
+}
+
+// Compares two file names, for qsort.
+int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// This function reads the puzzles of all the files of a directory into the batch,
+// in the order of their names.
+// Inputs:
+//      char *dirname: The name of the directory
+// Output:
+//      0 --> Successful read.
+//     -1 --> Unsuccessful read
+int add_batch_directory(char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (dir == NULL) {
+        printf("Cannot open directory %s.\n", dirname);
+        return -1;
+    }
+
+    char **names = NULL;
+    int count = 0;
+    int capacity = 0;
+    int err = 0;
+    struct dirent *entry;
+    struct stat st;
+    while (err == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char *path = (char*) malloc(strlen(dirname) + strlen(entry->d_name) + 2);
+        if (path == NULL) {
+            err = -1;
+            break;
+        }
+        sprintf(path, "%s/%s", dirname, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            char **grown = (char**) realloc(names, capacity * sizeof(char*));
+            if (grown == NULL) {
+                free(path);
+                err = -1;
+                break;
+            }
+            names = grown;
+        }
+        names[count++] = path;
+    }
+    closedir(dir);
+
+    if (err < 0) {
+        printf("Memory exhausted while reading %s.\n", dirname);
+    } else {
+        qsort(names, count, sizeof(char*), compare_names);
+    }
+    for (int i = 0; i < count; i++) {
+        if (err == 0) {
+            err = add_batch_file(names[i]);
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    return err;
+}
+
+// This function writes the result line of a puzzle: its name and position in its
+// file, the outcome (solved, unsolved, timeout or memory), the solution length, the
+// time spent, the boards expanded and generated and the moves, separated by tabs.
+// Inputs:
+//      struct batch_puzzle *puzzle: The puzzle
+//      int found: Whether it was solved
+//      double secs: Time spent on it
+void write_batch_result(struct batch_puzzle *puzzle, int found, double secs)
+{
+    char *status = outcome_name(found);
+    int length = found ? solution_length : 0;
+
+    pthread_mutex_lock(&batch_lock);
+    fprintf(batch_out, "%s:%d\t%s\t%d\t%f\t%lu\t%lu\t", puzzle->name, puzzle->index, status, length, secs,
+            stats.expanded, stats.generated);
+    for (int i = 0; i < length; i++) {
+        fprintf(batch_out, i == 0 ? "%s " : ",%s ", move_name(solution[i]));
+        print_card(batch_out, sol_moved0[i]);
+        if (solution[i] == stack) {
+            fprintf(batch_out, " ");
+            print_card(batch_out, sol_moved1[i]);
+        }
+    }
+    fprintf(batch_out, "\n");
+    fflush(batch_out);
+    pthread_mutex_unlock(&batch_lock);
+}
+
+// The main loop of a batch worker: it solves the next puzzle of the batch until
+// none is left.
+// Inputs:
+//      void *arg: Unused
+// Output:
+//      NULL
+void *batch_worker_main(void *arg)
+{
+    int i;
+    (void) arg;
+    while ((i = atomic_fetch_add(&batch_next, 1)) < batch_count) {
+        struct batch_puzzle *puzzle = &batch_puzzles[i];
+        N = puzzle->n;
+        double start = wall_clock();
+        int found = solve_puzzle(&puzzle->board, batch_method, 0);
+        write_batch_result(puzzle, found, wall_clock() - start);
+        if (found) {
+            atomic_fetch_add(&batch_solved, 1);
+        }
+        free_solution();
+    }
+
+    return NULL;
+}
+
+// This function solves all the puzzles of a directory or a file, --threads at a
+// time, writing a result line per puzzle as soon as it is done.
+// Inputs:
+//      int method: Execution algorithm.
+//      char *input: A directory of puzzle files or a file of puzzles
+//      char *output: The results file
+// Output:
+//      0 --> The batch has been run
+//     -1 --> Cannot read the puzzles or write the results
+int run_batch(int method, char *input, char *output)
+{
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        printf("Cannot open %s. Program terminates.\n", input);
+        return -1;
+    }
+    if ((S_ISDIR(st.st_mode) ? add_batch_directory(input) : add_batch_file(input)) < 0) {
+        return -1;
+    }
+
+    batch_out = fopen(output, "w");
+    if (batch_out == NULL) {
+        printf("Cannot open output file to write results.\n");
+        return -1;
+    }
+    fprintf(batch_out, "#puzzle\tstatus\tlength\ttime\texpanded\tgenerated\tmoves\n");
+
+    printf("Solving %d puzzles of %s using %s on %d threads...\n", batch_count, input, method_name(method), threads);
+    batch_method = method;
+    t1 = wall_clock();
+
+    // The main thread is a worker too.
+    pthread_t *workers = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 && started < batch_count - 1
+           && pthread_create(&workers[started], NULL, batch_worker_main, NULL) == 0) {
+        started++;
+    }
+    batch_worker_main(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    t2 = wall_clock();
+    fclose(batch_out);
+    printf("Solved %d of %d puzzles.\n", atomic_load(&batch_solved), batch_count);
+    printf("Time spent: %f secs\n", t2 - t1);
+
+    for (int i = 0; i < batch_count; i++) {
+        if (batch_puzzles[i].index == 1) {
+            free(batch_puzzles[i].name);
         }
-        fprintf(fout, "%d\n", m1[i].value);
-            
     }
+    free(batch_puzzles);
+
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-    int err;
-    struct tree_node* solution_node;
-    struct card puzzle[16][52]; // The initial puzzle read from a file.
-    int method;                 // The search algorithm that will be used to solve the puzzle.
-    int tops[16];
+    struct board puzzle; // The initial puzzle read from a file.
+    int method;          // The search algorithm that will be used to solve the puzzle.
+    char *args[3];       // The method, input and output file parameters.
+    int nargs = 0;
+    int found;
+
+    // Options may appear anywhere, the rest are the positional parameters.
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (nargs < 3) {
+                args[nargs] = argv[i];
+            }
+            nargs++;
+        } else if (get_option(argv[i]) < 0) {
+            printf("Wrong option %s. Use correct syntax:\n", argv[i]);
+            syntax_message();
+            return -1;
+        }
+    }
+    if (nargs != 3) {
+        printf("Wrong number of parameters. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
 
-    method = get_method(argv[1]);
+    method = get_method(args[0]);
     if (method<0) {
         printf("Wrong method. Use correct syntax:\n");
         syntax_message();
         return -1;
     }
+    if (!batch && threads > 1 && method != best && method != astar) {
+        printf("Only best and astar run in parallel. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (anytime > 0 && method != astar) {
+        printf("Only astar runs as an anytime search. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (!batch && threads > 1 && anytime > 0) {
+        printf("The anytime search cannot run in parallel. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (external_dir != NULL && (method != breadth || checkpoint_interval > 0)) {
+        printf("Only breadth runs in external memory, without delta. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (memory_bounded && ((method != best && method != astar) || memory_limit == 0)) {
+        printf("The memory-bounded mode needs best or astar and a --memory-limit. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (memory_bounded && (checkpoint_interval > 0 || anytime > 0 || (!batch && threads > 1))) {
+        printf("The memory-bounded mode cannot be combined with delta, anytime or parallel search. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
+    if (!batch && threads > 1 && checkpoint_interval > 0) {
+        printf("Delta mode cannot run in parallel. Use correct syntax:\n");
+        syntax_message();
+        return -1;
+    }
 
-    // Parsing puzzle
-    read_puzzle(argv[2], puzzle, tops);
+    if (pdb_file != NULL && load_pdb(pdb_file) < 0) {
+        return -1;
+    }
 
-    printf("Solving %s using %s...\n", argv[2], argv[1]);
-    t1 = clock();
+    init_zobrist();
+    if (batch) {
+        return run_batch(method, args[1], args[2]);
+    }
+
+    // Parsing puzzle
+    if (read_puzzle(args[1], &puzzle) < 0) {
+        return -1;
+    }
 
-    initialize_search(puzzle, tops, method);
-    // The main call.
-    solution_node = search(method);
+    printf("Solving %s using %s...\n", args[1], args[0]);
+    anytime_output = args[2];
+    t1 = wall_clock();
+    found = solve_puzzle(&puzzle, method, threads > 1);
+    t2 = wall_clock();
 
-    t2 = clock();
-    
-    if (solution_node == NULL) {
+    if (found && solution_length > 0) {
+        printf("Solution found! (%d steps)\n", solution_length);
+    } else if (mem_error == -1) {
+        printf("Search stopped: out of memory.\n");
+    } else if (stop_reason != STOP_NONE) {
+        printf("Search stopped: %s.\n", stop_reason == STOP_TIME ? "time limit reached"
+               : stop_reason == STOP_NODES ? "node limit reached" : stop_reason == STOP_RSS ? "RSS limit reached"
+               : "cannot write or read the layer files");
+    } else if (method == beam) {
+        printf("No solution found: the beam emptied.\n");
+    } else {
         printf("No solution found.\n");
-        return 0;
     }
-
-    extract_solution(solution_node);
-    if (mem_error == -1) {
-        printf("Memory exhausted while creating solution path...\n");
-        return 0;
+    printf("Time spent: %f secs\n", t2 - t1);
+    printf("Nodes expanded: %lu\n", stats.expanded);
+    printf("Nodes generated: %lu\n", stats.generated);
+    printf("Peak memory: %ld KB\n", peak_rss_kb());
+    if (stats_format > 0) {
+        print_stats(method, found && solution_length > 0, t2 - t1);
     }
-    
-    if (solution_length == 0) {
-        printf("No solution found.\n");
-        return 0;
+
+    if (found && solution_length > 0) {
+        write_solution_to_file(args[2], solution_length, solution, sol_moved0, sol_moved1);
     }
-    
-    printf("Solution found! (%d steps)\n", solution_length);
-    printf("Time spent: %f secs\n", ((float)t2 - t1) / CLOCKS_PER_SEC);
-    write_solution_to_file(argv[3], solution_length, solution, sol_moved0, sol_moved1);
 
     return 0;
 }